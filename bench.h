@@ -0,0 +1,50 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/* Times the scan: the clock, every component's update(), one after
+   another, the timers, then the output queue drained into the report,
+   the way loop() does when everything's due. Does that `scans` times
+   and prints the average and the worst, in microseconds, off
+   halMicros(), so the numbers from one board can be held up against
+   another's.
+
+   It runs the scans back to back, and drains the queue without
+   sending anything, so it can't share the loop with a host that's
+   listening. On a PC, see host/falconpanel-bench.cpp. On a board,
+   build the sketch with FALCONPANEL_BENCH defined: it times a
+   thousand quiet scans once the serial port's open, before the panel
+   gets going, and prints them there. */
+void benchScans(Component** components, int count, unsigned int scans, Print* out) {
+  unsigned long total = 0;
+  unsigned long worst = 0;
+  for (unsigned int n = 0; n < scans; ++n) {
+    unsigned long start = halMicros();
+    panelClock.tick();
+    sampler.acquire();
+    for (int i = 0; i < count; ++i) {
+      scanningComponent = i;
+      components[i]->update();
+    }
+    scanningComponent = NoComponent;
+    timers.run();
+    outputs.drain(&panelReport);
+    unsigned long took = halMicros() - start;
+    total += took;
+    worst = max(worst, took);
+  }
+  out->print(scans);
+  out->print(F(" scans of "));
+  out->print(count);
+  out->print(F(" components: average "));
+  // To a hundredth of a microsecond, for boards that are quicker than
+  // one.
+  unsigned long hundredths = total % scans * 100 / scans;
+  out->print(total / scans);
+  out->print(hundredths < 10 ? F(".0") : F("."));
+  out->print(hundredths);
+  out->print(F("us, worst "));
+  out->print(worst);
+  out->println(F("us"));
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#ifndef FALCONPANEL_HOST
+#include <EEPROM.h>
+#endif
+
+/* Pots almost never make it all the way from 0 to 1023 - the ends of
+   the track, the wiper and the wiring all take a bite - and the bite
+   is different for every pot. A CalibratedAnalogInput learns where
+   its pot actually stops, remembers that in EEPROM, and stretches the
+   readings back out to the full range.
+
+   Each one gets a `slot` in EEPROM; give every calibrated input a
+   different one. Calibrating goes like this: start it (the 'c' serial
+   command), sweep every pot from one end to the other, leave the
+   centred ones in the middle, and finish it ('c' again). */
+
+const unsigned int CalibrationMagic = 0xFC01;
+const int CalibrationSlotSize = 3 * sizeof(int);
+
+/* The three counts that describe one pot, and the scale factors that
+   turn a raw reading into a calibrated one with a multiply and a
+   shift. Going in two halves, either side of the centre, lets a
+   centred pot land on exactly half-way when it's in its detent. */
+class PotRange {
+ private:
+  int _min;
+  int _centre;
+  int _max;
+  unsigned long _lowScale;
+  unsigned long _highScale;
+
+ public:
+  PotRange() {
+    set(0, AnalogCounts / 2, AnalogCounts - 1);
+  }
+
+  void set(int lowest, int centre, int highest) {
+    _min = lowest;
+    _centre = centre;
+    _max = highest;
+    // Fixed point, 16 bits after the point.
+    _lowScale = ((unsigned long)(AnalogCounts / 2) << 16) / max(_centre - _min, 1);
+    _highScale = ((unsigned long)(AnalogCounts / 2 - 1) << 16) / max(_max - _centre, 1);
+  }
+
+  /* True if these look like they came from a real calibration. */
+  bool sane() {
+    return _min >= 0 && _min < _centre && _centre < _max && _max < AnalogCounts;
+  }
+
+  int lowest() {
+    return _min;
+  }
+
+  int centre() {
+    return _centre;
+  }
+
+  int highest() {
+    return _max;
+  }
+
+  int map(int raw) {
+    if (raw <= _min) {
+      return 0;
+    }
+    if (raw >= _max) {
+      return AnalogCounts - 1;
+    }
+    if (raw < _centre) {
+      return ((raw - _min) * _lowScale) >> 16;
+    }
+    return AnalogCounts / 2 + (((raw - _centre) * _highScale) >> 16);
+  }
+};
+
+class CalibratedAnalogInput;
+
+/* Every calibrated input, so they can all be calibrated at once. */
+class Calibration {
+ private:
+  CalibratedAnalogInput* _head;
+  bool _running;
+
+ public:
+  Calibration() {
+    _head = 0;
+    _running = false;
+  }
+
+  void add(CalibratedAnalogInput* input);
+
+  bool running() {
+    return _running;
+  }
+
+  void start();
+  void finish();
+};
+
+Calibration calibration;
+
+class CalibratedAnalogInput : public AnalogInput {
+  friend class Calibration;
+
+ private:
+  AnalogInput* _in;
+  byte _slot;
+  bool _centred;
+  PotRange _range;
+  int _seenMin;
+  int _seenMax;
+  CalibratedAnalogInput* _next;
+
+  int address() {
+    return sizeof(CalibrationMagic) + _slot * CalibrationSlotSize;
+  }
+
+  void load() {
+    unsigned int magic;
+    EEPROM.get(0, magic);
+    if (magic != CalibrationMagic) {
+      return;
+    }
+    int counts[3];
+    EEPROM.get(address(), counts);
+    PotRange range;
+    range.set(counts[0], counts[1], counts[2]);
+    if (range.sane()) {
+      _range = range;
+    }
+  }
+
+  void save() {
+    int counts[3] = { _range.lowest(), _range.centre(), _range.highest() };
+    EEPROM.put(address(), counts);
+    EEPROM.put(0, CalibrationMagic);
+  }
+
+  void start() {
+    _seenMin = AnalogCounts;
+    _seenMax = -1;
+  }
+
+  void finish() {
+    if (_seenMax <= _seenMin) {
+      // Never moved; keep what we had.
+      return;
+    }
+    int centre = _centred ? _in->readCounts() : (_seenMin + _seenMax) / 2;
+    PotRange range;
+    range.set(_seenMin, centre, _seenMax);
+    if (range.sane()) {
+      _range = range;
+      save();
+    }
+  }
+
+ public:
+  /* Set `centred` for pots with a detent or a natural middle, which
+     should be left there when calibration finishes. For the rest,
+     the centre is taken to be half way between the ends. */
+  CalibratedAnalogInput(AnalogInput* in, byte slot, bool centred = false) {
+    _in = in;
+    _slot = slot;
+    _centred = centred;
+    _seenMin = AnalogCounts;
+    _seenMax = -1;
+    _next = 0;
+    calibration.add(this);
+  }
+
+  virtual void setup() {
+    _in->setup();
+    load();
+  }
+
+  virtual int readCounts() {
+    int raw = _in->readCounts();
+    if (calibration.running()) {
+      _seenMin = min(_seenMin, raw);
+      _seenMax = max(_seenMax, raw);
+    }
+    return _range.map(raw);
+  }
+};
+
+void Calibration::add(CalibratedAnalogInput* input) {
+  input->_next = _head;
+  _head = input;
+}
+
+void Calibration::start() {
+  for (CalibratedAnalogInput* input = _head; input; input = input->_next) {
+    input->start();
+  }
+  _running = true;
+}
+
+void Calibration::finish() {
+  _running = false;
+  for (CalibratedAnalogInput* input = _head; input; input = input->_next) {
+    input->finish();
+  }
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _COMPONENTS_H
 #define _COMPONENTS_H
 
+#include "hal.h"
+
 /* An "interface" class representing a thing that can be initialized.
    Important for things like pins on the Arduino, but also components
    that manage them. */
@@ -17,11 +19,598 @@ class Updateable {
   virtual void update() = 0;
 };
 
+/* Microseconds and milliseconds since startup, for anything that
+   wants to know, interrupt handlers included. Both wrap - the
+   microseconds after about 71 minutes - so subtract, don't compare.
+
+   On a board, this is halMicros() and halMillis(). I had it reading Timer1
+   for a while, to keep interrupts on, but a 16-bit timer read has to
+   be done with interrupts off too, and it came out at the same 4us a
+   tick, so there was nothing in it. What's left is one place to ask,
+   and one place to swap out.
+
+   A host build (define FALCONPANEL_HOST) gets a fake clock instead,
+   which only moves when it's told to with set() or advance(). */
+class MicroClock {
+#ifndef FALCONPANEL_HOST
+ public:
+  unsigned long us() {
+    return halMicros();
+  }
+
+  unsigned long ms() {
+    return halMillis();
+  }
+#else
+ private:
+  unsigned long _us;
+
+ public:
+  MicroClock() {
+    _us = 0;
+  }
+
+  unsigned long us() {
+    return _us;
+  }
+
+  unsigned long ms() {
+    return _us / 1000;
+  }
+
+  void set(unsigned long us) {
+    _us = us;
+  }
+
+  void advance(unsigned long us) {
+    _us += us;
+  }
+#endif
+};
+
+MicroClock microClock;
+
+/* The one clock everybody agrees on. It gets sampled once at the top
+   of every pass through loop(), so all the components see the same
+   "now" no matter how long the ones ahead of them took. Times are in
+   milliseconds and wrap after about 49 days, so compare them with
+   reached() rather than with < or >. */
+class Clock {
+ private:
+  unsigned long _now;
+
+ public:
+  Clock() {
+    _now = 0;
+  }
+
+  void tick() {
+    _now = microClock.ms();
+  }
+
+  unsigned long now() {
+    return _now;
+  }
+
+  /* True once `deadline` is at or behind us, even across wraparound. */
+  bool reached(unsigned long deadline) {
+    return long(_now - deadline) >= 0;
+  }
+
+  /* Milliseconds left until `deadline`, or zero if it's passed. */
+  unsigned long until(unsigned long deadline) {
+    long remaining = long(deadline - _now);
+    return remaining > 0 ? remaining : 0;
+  }
+};
+
+Clock panelClock;
+
+/* Something that wants to be told when a moment in time has arrived.
+   Schedule it on the timer queue and expire() gets called on the
+   first pass through the loop at or after the deadline. */
+class Timer {
+  friend class TimerQueue;
+
+ private:
+  Timer* _next;
+  unsigned long _deadline;
+  bool _armed;
+
+ public:
+  Timer() {
+    _next = 0;
+    _deadline = 0;
+    _armed = false;
+  }
+
+  bool armed() {
+    return _armed;
+  }
+
+  virtual void expire() = 0;
+};
+
+/* Pending timers, kept as a list sorted by deadline, so finding out
+   whether anything is due is a single compare against the head. */
+class TimerQueue {
+ private:
+  Timer* _head;
+
+ public:
+  TimerQueue() {
+    _head = 0;
+  }
+
+  /* Arms `timer` to go off `delay` milliseconds from now. A timer that
+     is already armed gets rescheduled. */
+  void schedule(Timer* timer, unsigned long delay) {
+    cancel(timer);
+    timer->_deadline = panelClock.now() + delay;
+    timer->_armed = true;
+
+    Timer** link = &_head;
+    while (*link && long((*link)->_deadline - timer->_deadline) <= 0) {
+      link = &(*link)->_next;
+    }
+    timer->_next = *link;
+    *link = timer;
+  }
+
+  void cancel(Timer* timer) {
+    if (!timer->_armed) {
+      return;
+    }
+    for (Timer** link = &_head; *link; link = &(*link)->_next) {
+      if (*link == timer) {
+        *link = timer->_next;
+        break;
+      }
+    }
+    timer->_next = 0;
+    timer->_armed = false;
+  }
+
+  bool pending() {
+    return _head != 0;
+  }
+
+  /* Milliseconds until the earliest deadline, or `limit` if nothing
+     is due before then. */
+  unsigned long idleFor(unsigned long limit) {
+    if (!_head) {
+      return limit;
+    }
+    return min(panelClock.until(_head->_deadline), limit);
+  }
+
+  /* Fires everything that's due. Timers are disarmed before expire()
+     is called, so they're free to reschedule themselves. */
+  void run() {
+    while (_head && panelClock.reached(_head->_deadline)) {
+      Timer* timer = _head;
+      _head = timer->_next;
+      timer->_next = 0;
+      timer->_armed = false;
+      timer->expire();
+    }
+  }
+};
+
+TimerQueue timers;
+
+/* The index of the component whose update() is running, so changes
+   can say where they came from. The loop sets it. */
+const byte NoComponent = 0xFF;
+byte scanningComponent = NoComponent;
+
+enum RecordKind : byte {
+  RecordBoot, RecordInput, RecordButton, RecordReport, RecordOverrun
+};
+
+/* One thing that happened, in the flight recorder. */
+struct Record {
+  // microClock.us(), which starts again from 0 at every boot.
+  unsigned long time;
+  // RecordBoot: the reset flags. RecordInput: the level.
+  // RecordButton: 1 for pressed, 0 for released. RecordReport: the
+  // buttons that went to the host, one bit each. RecordOverrun: how
+  // long the scan took, in microseconds.
+  unsigned long value;
+  RecordKind kind;
+  // RecordBoot: the boot count. RecordInput: the input's number, as
+  // in the 'h' report. RecordButton: the button number.
+  byte index;
+  // scanningComponent, at the time.
+  byte component;
+};
+
+/* Must be a power of two. */
+const byte RecorderSize = 32;
+const uint16_t RecorderMagic = 0xF1C0;
+
+/* The flight recorder's memory. It lives where a reset doesn't clear
+   it, so it's plain data with no constructor to wipe it either. */
+struct RecorderLog {
+  uint16_t magic;
+  byte boots;
+  unsigned long logged;
+  Record records[RecorderSize];
+};
+
+RecorderLog recorderLog HAL_NOINIT;
+
+/* The last RecorderSize things that happened: inputs changing,
+   buttons being pressed and released, and reports going to the host.
+   On an AVR it survives a reset that isn't a power cycle - the
+   watchdog going off, say - so after a glitch you can send 'r' over
+   the serial port and see what led up to it. Every boot adds a
+   RecordBoot, so you can tell which records came before the reset.
+
+   Logging a record is a handful of stores, so it stays on. It's only
+   called from the loop, never from an interrupt, so it doesn't need
+   to turn them off. Axes aren't logged; a pot that's being turned
+   would push everything else out. */
+class FlightRecorder {
+ private:
+  unsigned long _dumpEnd;
+
+ public:
+  FlightRecorder() {
+    _dumpEnd = 0;
+  }
+
+  /* Keeps what's there if it's left over from before a reset, starts
+     afresh if not, and notes the boot either way. Call it first thing
+     in setup(). */
+  void begin() {
+    byte cause = halResetCause();
+    if (recorderLog.magic != RecorderMagic) {
+      recorderLog.magic = RecorderMagic;
+      recorderLog.boots = 0;
+      recorderLog.logged = 0;
+    }
+    ++recorderLog.boots;
+    log(RecordBoot, recorderLog.boots, cause);
+  }
+
+  void log(RecordKind kind, byte index, unsigned long value) {
+    Record* record = &recorderLog.records[recorderLog.logged & (RecorderSize - 1)];
+    record->time = microClock.us();
+    record->value = value;
+    record->kind = kind;
+    record->index = index;
+    record->component = scanningComponent;
+    ++recorderLog.logged;
+  }
+
+  /* Row 0 is a heading, and the rest are the records that were there
+     when it was printed, oldest first. If new ones push a record out
+     before its row comes up, the row says so. False past the last. */
+  bool status(byte row, Print* out) {
+    if (row == 0) {
+      _dumpEnd = recorderLog.logged;
+    }
+    byte count = min(_dumpEnd, (unsigned long)RecorderSize);
+    if (row == 0) {
+      out->print(F("boot "));
+      out->print(recorderLog.boots);
+      out->print(F(", "));
+      out->print(count);
+      out->println(F(" records, oldest first"));
+      return count > 0;
+    }
+    if (row > count) {
+      return false;
+    }
+    unsigned long n = _dumpEnd - count + row - 1;
+    if (recorderLog.logged - n > RecorderSize) {
+      out->println(F("(overwritten)"));
+      return row < count;
+    }
+    const Record* record = &recorderLog.records[n & (RecorderSize - 1)];
+    out->print(record->time);
+    out->print(F("us "));
+    switch (record->kind) {
+    case RecordBoot:
+      out->print(F("boot "));
+      out->print(record->index);
+      out->print(F(", reset flags "));
+      out->print(record->value);
+      break;
+    case RecordInput:
+      out->print(F("input "));
+      out->print(record->index);
+      out->print(record->value ? F(" high") : F(" low"));
+      break;
+    case RecordButton:
+      out->print(F("button "));
+      out->print(record->index);
+      out->print(record->value ? F(" pressed") : F(" released"));
+      break;
+    case RecordReport:
+      out->print(F("report "));
+      for (int i = 31; i >= 0; --i) {
+        out->print(bitRead(record->value, i) ? '1' : '0');
+      }
+      break;
+    case RecordOverrun:
+      out->print(F("scan overran, "));
+      out->print(record->value);
+      out->print(F("us"));
+      break;
+    }
+    if (record->component != NoComponent) {
+      out->print(F(", component "));
+      out->print(record->component);
+    }
+    out->println();
+    return row < count;
+  }
+};
+
+FlightRecorder recorder;
+
+enum AxisId : byte {
+  AxisX, AxisY, AxisZ, AxisXRotation, AxisYRotation, AxisZRotation, AxisCount
+};
+
+/* Everything we tell the host: the 32 buttons and six axes of the
+   Gamepad. Buttons and axes write in here rather than to the Gamepad
+   directly, which lets a satellite board ship its report somewhere
+   other than its own USB port, and lets the master skip writing
+   reports when nothing changed. */
+class Report {
+ private:
+  unsigned long _buttons;
+  int _axes[AxisCount];
+  byte _usedAxes;
+  bool _dirty;
+
+ public:
+  Report() {
+    _buttons = 0;
+    for (byte i = 0; i < AxisCount; ++i) {
+      _axes[i] = 0;
+    }
+    _usedAxes = 0;
+    _dirty = true;
+  }
+
+  /* Buttons are numbered from 1, like on the Gamepad. Anything past
+     32 doesn't fit, and is ignored. */
+  void setButton(byte num, bool state) {
+    if (num < 1 || num > 32) {
+      return;
+    }
+    unsigned long bit = 1UL << (num - 1);
+    unsigned long buttons = state ? (_buttons | bit) : (_buttons & ~bit);
+    if (buttons != _buttons) {
+      _buttons = buttons;
+      _dirty = true;
+    }
+  }
+
+  void setButtons(unsigned long buttons) {
+    if (buttons != _buttons) {
+      _buttons = buttons;
+      _dirty = true;
+    }
+  }
+
+  unsigned long buttons() {
+    return _buttons;
+  }
+
+  /* Axis values are already scaled the way the Gamepad wants them:
+     16 bits for X, Y and their rotations, 8 for Z and Z rotation. */
+  bool setAxis(byte axis, int val) {
+    _usedAxes |= 1 << axis;
+    if (val == _axes[axis]) {
+      return false;
+    }
+    _axes[axis] = val;
+    _dirty = true;
+    return true;
+  }
+
+  int axis(byte axis) {
+    return _axes[axis];
+  }
+
+  /* The axes anything has set, one bit each. The rest are just
+     sitting at 0. */
+  byte usedAxes() {
+    return _usedAxes;
+  }
+
+  bool dirty() {
+    return _dirty;
+  }
+
+  void clean() {
+    _dirty = false;
+  }
+
+#ifndef FALCONPANEL_SATELLITE
+  /* Writes the whole thing out to the host. */
+  void send() {
+    halHidSend(_buttons, _axes);
+    recorder.log(RecordReport, 0, _buttons);
+    _dirty = false;
+  }
+#endif
+};
+
+Report panelReport;
+
+enum OutputKind : byte {
+  OutputButton, OutputAxis
+};
+
+/* One change to a button or an axis, on its way to the report. */
+struct OutputEvent {
+  OutputKind kind;
+  // The button number (from 1) or the AxisId.
+  byte index;
+  // 0 or 1 for a button, the report value for an axis.
+  int value;
+  // scanningComponent, when the change was made.
+  byte component;
+  // microClock.us(), when the change was made.
+  unsigned long time;
+};
+
+/* Something that wants to hear about every change to a button or an
+   axis, on top of it going into the report. */
+class ReportListener {
+ public:
+  virtual void changed(const OutputEvent* event) = 0;
+};
+
+ReportListener* reportListener = 0;
+
+/* Changes don't go into the report as they're made. Buttons and axes
+   post them here, stamped with the time and the component that made
+   them, and the loop drains them into the report once the scan is
+   done. That's where they get sent on to reportListener, too, so
+   anything that isn't the Gamepad can hear about them without the
+   components knowing.
+
+   Draining stops early at a second change to the same button, so a
+   press and release made in one scan go out in two reports rather
+   than cancelling out in one. If the queue fills up, the oldest change
+   goes straight into the report to make room.
+
+   It also remembers which component last moved each button, which is
+   as close as we get to a button map: the components don't say which
+   buttons they've got. */
+class OutputQueue {
+ private:
+  OutputEvent* _events;
+  byte _capacity;
+  byte _head;
+  byte _size;
+  int _axes[AxisCount];
+  byte _deepest;
+  unsigned long _overflows;
+  unsigned long _lastLatency;
+  unsigned long _maxLatency;
+  byte _owners[32];
+
+  void applyOldest(Report* report) {
+    OutputEvent* event = &_events[_head];
+    if (event->kind == OutputButton) {
+      report->setButton(event->index, event->value);
+    }
+    else {
+      report->setAxis(event->index, event->value);
+    }
+    _lastLatency = microClock.us() - event->time;
+    _maxLatency = max(_maxLatency, _lastLatency);
+    if (reportListener) {
+      reportListener->changed(event);
+    }
+    _head = (_head + 1) % _capacity;
+    --_size;
+  }
+
+ public:
+  OutputQueue(byte capacity) {
+    _events = new OutputEvent[capacity];
+    _capacity = capacity;
+    _head = 0;
+    _size = 0;
+    for (byte i = 0; i < AxisCount; ++i) {
+      _axes[i] = 0;
+    }
+    _deepest = 0;
+    _overflows = 0;
+    _lastLatency = 0;
+    _maxLatency = 0;
+    memset(_owners, NoComponent, sizeof(_owners));
+  }
+
+  void post(OutputKind kind, byte index, int value) {
+    if (kind == OutputAxis) {
+      if (_axes[index] == value) {
+        return;
+      }
+      _axes[index] = value;
+    }
+    else if (index >= 1 && index <= 32 && scanningComponent != NoComponent) {
+      _owners[index - 1] = scanningComponent;
+    }
+    if (_size == _capacity) {
+      applyOldest(&panelReport);
+      ++_overflows;
+    }
+    OutputEvent* event = &_events[(_head + _size) % _capacity];
+    event->kind = kind;
+    event->index = index;
+    event->value = value;
+    event->component = scanningComponent;
+    event->time = microClock.us();
+    ++_size;
+    _deepest = max(_deepest, _size);
+  }
+
+  /* Moves queued changes into `report`, oldest first. */
+  void drain(Report* report) {
+    unsigned long touched = 0;
+    while (_size > 0) {
+      OutputEvent* event = &_events[_head];
+      if (event->kind == OutputButton && event->index >= 1 && event->index <= 32) {
+        unsigned long bit = 1UL << (event->index - 1);
+        if (touched & bit) {
+          break;
+        }
+        touched |= bit;
+      }
+      applyOldest(report);
+    }
+  }
+
+  bool pending() {
+    return _size > 0;
+  }
+
+  /* The component that last pressed or released button `num`, or
+     NoComponent if none has yet - presses from a PressQueue or a
+     satellite don't count. */
+  byte owner(byte num) {
+    return num >= 1 && num <= 32 ? _owners[num - 1] : NoComponent;
+  }
+
+  void status(Print* out) {
+    out->print(F("queued "));
+    out->print(_size);
+    out->print(F(", deepest "));
+    out->print(_deepest);
+    out->print(F(" of "));
+    out->print(_capacity);
+    out->print(F(", overflows "));
+    out->println(_overflows);
+    out->print(F("latency last "));
+    out->print(_lastLatency);
+    out->print(F("us, max "));
+    out->print(_maxLatency);
+    out->println(F("us"));
+  }
+};
+
+OutputQueue outputs(32);
+
 /* Abstracts the concept of a DirectX button. */
 class Button : public Updateable {
  public:
   virtual void press() = 0;
   virtual void release() = 0;
+
+  /* True while the button still has updates to count. */
+  virtual bool busy() {
+    return false;
+  }
 };
 
 /* I tried making this a method of the Button class, but I got a weird
@@ -37,123 +626,324 @@ void setButton(Button* button, bool state) {
 
 /* An actual button on the Gamepad. There are 32 available on the
    Gamepad, numbered from 1-32. At some point, I might extend this to
-   cover the hat.*/
+   cover the hat. Numbers past 32 never make it to the Gamepad, but
+   reportListener still hears about them, so they're good for the
+   serial event stream. */
 class DxButton : public Button {
  private:
   int _num;
+  bool _pressed;
+
+  void set(bool state) {
+    if (state == _pressed) {
+      return;
+    }
+    _pressed = state;
+    recorder.log(RecordButton, _num, state);
+    outputs.post(OutputButton, _num, state);
+  }
 
  public:
   DxButton(int num) {
     _num = num;
+    _pressed = false;
   }
 
   virtual void press() {
-    Gamepad.press(_num);
+    set(true);
   }
 
   virtual void release() {
-    Gamepad.release(_num);
+    set(false);
   }
 
   virtual void update() { }
 };
 
+/* How long a tick is, for things that count in them, in
+   milliseconds. It used to be one scan; scans come at odd times now,
+   so it's real time. */
+const unsigned int TickMs = 75;
+
 /* Adapts a DirectX button to be one that will be pressed momentarily.
-   That is, when it is pressed, after `duration` updates, it will be
-   released even without an explicit call to release. */
+   That is, when it is pressed, after `duration` ticks, it will be
+   released even without an explicit call to release. It lets go at
+   the first update after that, so it needs updating while it's
+   busy(). */
 class MomentaryButton : public Button {
  private:
   Button* _inner;
-  int _duration;
-  int _countdown;
+  unsigned long _durationMs;
+  unsigned long _releaseAt;
+  bool _held;
 
  public:
   MomentaryButton(Button* inner, int duration = 3) {
     _inner = inner;
-    _duration = duration;
+    _durationMs = (unsigned long)duration * TickMs;
+    _releaseAt = 0;
+    _held = false;
   }
 
   virtual void press() {
     _inner->press();
-    _countdown = _duration;
+    _releaseAt = panelClock.now() + _durationMs;
+    _held = true;
   }
 
   virtual void release() {
     _inner->release();
-    _countdown = 0;
+    _held = false;
   }
 
   virtual void update() {
-    if (_countdown > 0) {
-      --_countdown;
-      if (_countdown == 0) {
-        _inner->release();
+    if (_held && panelClock.reached(_releaseAt)) {
+      _inner->release();
+      _held = false;
+    }
+  }
+
+  virtual bool busy() {
+    return _held;
+  }
+};
+
+/* Presses buttons one at a time, holding each for `holdMs` and then
+   leaving `gapMs` before the next, so the host sees every one of them
+   rather than a pile-up in a single report. Buttons that don't fit
+   in the queue are dropped. */
+class PressQueue : public Timer {
+ private:
+  Button** _queue;
+  byte _capacity;
+  byte _head;
+  byte _size;
+  unsigned int _holdMs;
+  unsigned int _gapMs;
+  Button* _pressed;
+
+ public:
+  PressQueue(byte capacity, unsigned int holdMs = 25, unsigned int gapMs = 25) {
+    _queue = new Button*[capacity];
+    _capacity = capacity;
+    _head = 0;
+    _size = 0;
+    _holdMs = holdMs;
+    _gapMs = gapMs;
+    _pressed = 0;
+  }
+
+  bool enqueue(Button* button) {
+    if (_size == _capacity) {
+      return false;
+    }
+    _queue[(_head + _size) % _capacity] = button;
+    ++_size;
+    if (!armed() && !_pressed) {
+      timers.schedule(this, 0);
+    }
+    return true;
+  }
+
+  bool busy() {
+    return _size > 0 || _pressed;
+  }
+
+  virtual void expire() {
+    if (_pressed) {
+      _pressed->release();
+      _pressed = 0;
+      if (_size > 0) {
+        timers.schedule(this, _gapMs);
       }
     }
+    else if (_size > 0) {
+      _pressed = _queue[_head];
+      _head = (_head + 1) % _capacity;
+      --_size;
+      _pressed->press();
+      timers.schedule(this, _holdMs);
+    }
   }
 };
 
 /* These next few classes shouldn't be necessary, but unfortunately I
    had no luck getting function pointers to work. So back to OOP
-   land. */
+   land. Positions run from 0 at one end of the axis to 65535 at the
+   other. */
 class DxAxisAdapter {
  public:
-  virtual void report(float val) = 0;
+  virtual void report(uint16_t pos) = 0;
 };
 
-short scale16(float val) {
-  return short(val * 65536) - 32768;
+void setAxis(byte axis, int val) {
+  outputs.post(OutputAxis, axis, val);
+}
+
+short scale16(uint16_t pos) {
+  return short(long(pos) - 32768);
 };
 
-byte scale8(float val) {
-  return byte(val * 256) - 128;
+byte scale8(uint16_t pos) {
+  return byte(pos >> 8) - 128;
 };
 
 class DxXAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.xAxis(scale16(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisX, scale16(pos)); };
 };
 
 class DxYAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.yAxis(scale16(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisY, scale16(pos)); };
 };
 
 class DxZAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.zAxis(scale8(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisZ, scale8(pos)); };
 };
 
 class DxXRotAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.rxAxis(scale16(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisXRotation, scale16(pos)); };
 };
 
 class DxYRotAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.ryAxis(scale16(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisYRotation, scale16(pos)); };
 };
 
 class DxZRotAxisAdapter : public DxAxisAdapter {
-  virtual void report(float val) { Gamepad.rzAxis(scale8(val)); };
+  virtual void report(uint16_t pos) { setAxis(AxisZRotation, scale8(pos)); };
 };
 
+/* Response curves, for axes that shouldn't move in a straight line
+   with the knob. A curve is a table of CurvePoints positions, evenly
+   spaced along the axis and kept in flash; anything in between is
+   interpolated. That's a couple of table reads and one multiply per
+   sample, which the AVR can afford where pow() every scan isn't.
+
+   The tables get worked out by the compiler. Pick a shape and how
+   much of it you want, from 0 (a straight line) to 100:
+
+     const uint16_t trimCurve[CurvePoints] PROGMEM = CURVE_TABLE(expoPoint, 40);
+
+   and hand the table to one of the DxAxis factories. A table made
+   some other way - a spreadsheet, say - works just as well, as long
+   as it has CurvePoints entries and goes in PROGMEM. */
+const byte CurveShift = 12;
+const byte CurvePoints = (1 << (16 - CurveShift)) + 1;
+// The gaps between points, and half of them.
+const long long CurveSteps = CurvePoints - 1;
+const long long CurveHalf = CurveSteps / 2;
+
+/* The value of a point on a curve that's numerator / denominator of
+   the way along the axis, rounded. */
+constexpr uint16_t curvePoint(long long numerator, long long denominator) {
+  return uint16_t((65535LL * numerator + denominator / 2) / denominator);
+}
+
+/* Gentle in the middle and steep at the ends, for centred axes like
+   trims: the classic radio-control expo, a blend of a straight line
+   and a cube centred on the middle of the axis. */
+constexpr uint16_t expoPoint(int i, int amount) {
+  return curvePoint((100LL - amount) * (i - CurveHalf) * CurveHalf * CurveHalf +
+                    (long long)amount * (i - CurveHalf) * (i - CurveHalf) * (i - CurveHalf) +
+                    100 * CurveHalf * CurveHalf * CurveHalf,
+                    200 * CurveHalf * CurveHalf * CurveHalf);
+}
+
+/* Gentle at the start and steep at the end, for axes that start at
+   zero: a blend of a straight line and a cube. */
+constexpr uint16_t powerPoint(int i, int amount) {
+  return curvePoint((100LL - amount) * i * CurveSteps * CurveSteps + (long long)amount * i * i * i,
+                    100 * CurveSteps * CurveSteps * CurveSteps);
+}
+
+/* Gentle at both ends and steep in the middle: a blend of a straight
+   line and smoothstep. */
+constexpr uint16_t sCurvePoint(int i, int amount) {
+  return curvePoint((100LL - amount) * i * CurveSteps * CurveSteps +
+                    (long long)amount * (3 * CurveSteps * i * i - 2LL * i * i * i),
+                    100 * CurveSteps * CurveSteps * CurveSteps);
+}
+
+/* The points get spelled out, since C++11 has no way to loop over
+   them here, so CurveShift is fixed at 12: change one and the other
+   has to follow. */
+static_assert(CurvePoints == 17, "CURVE_TABLE lists 17 points");
+
+#define CURVE_TABLE(point, amount) {                                  \
+    point(0, amount), point(1, amount), point(2, amount),             \
+    point(3, amount), point(4, amount), point(5, amount),             \
+    point(6, amount), point(7, amount), point(8, amount),             \
+    point(9, amount), point(10, amount), point(11, amount),           \
+    point(12, amount), point(13, amount), point(14, amount),          \
+    point(15, amount), point(16, amount) }
+
+uint16_t applyCurve(const uint16_t* curve, uint16_t pos) {
+  if (pos == 65535) {
+    // Otherwise we'd stop one step short of the last point.
+    return pgm_read_word(curve + CurvePoints - 1);
+  }
+  byte i = pos >> CurveShift;
+  uint16_t fraction = pos & ((1 << CurveShift) - 1);
+  uint16_t from = pgm_read_word(curve + i);
+  uint16_t to = pgm_read_word(curve + i + 1);
+  return from + ((long(to) - from) * fraction >> CurveShift);
+}
+
+/* How many axis reports went nowhere because the axis hadn't moved. */
+unsigned long axisReportsSkipped = 0;
+
 /* Abstracts the concept of a DirectX axis. Axis values are normalized
-   to a floating point number in the range 0.0 to 1.0 (inclusive). */
+   to a floating point number in the range 0.0 to 1.0 (inclusive), or
+   to a position from 0 to 65535 for callers that would rather stay in
+   integers. Each factory takes an optional response curve.
+
+   It remembers the last position it was given, and a report of the
+   same position again is dropped after one compare, before the curve
+   or the scaling - which is most reports, since most knobs sit still
+   most of the time. */
 class DxAxis {
  private:
   DxAxisAdapter* _adapter;
+  const uint16_t* _curve;
+  uint16_t _last;
+  bool _reported;
 
-  DxAxis(DxAxisAdapter* adapter) {
+  DxAxis(DxAxisAdapter* adapter, const uint16_t* curve) {
     _adapter = adapter;
+    _curve = curve;
+    _last = 0;
+    _reported = false;
   }
 
  public:
-  static DxAxis* X() { return new DxAxis(new DxXAxisAdapter()); }
-  static DxAxis* Y() { return new DxAxis(new DxYAxisAdapter()); }
-  static DxAxis* Z() { return new DxAxis(new DxZAxisAdapter()); }
-  static DxAxis* XRotation() { return new DxAxis(new DxXRotAxisAdapter()); }
-  static DxAxis* YRotation() { return new DxAxis(new DxYRotAxisAdapter()); }
-  static DxAxis* ZRotation() { return new DxAxis(new DxZRotAxisAdapter()); }
+  static DxAxis* X(const uint16_t* curve = 0) { return new DxAxis(new DxXAxisAdapter(), curve); }
+  static DxAxis* Y(const uint16_t* curve = 0) { return new DxAxis(new DxYAxisAdapter(), curve); }
+  static DxAxis* Z(const uint16_t* curve = 0) { return new DxAxis(new DxZAxisAdapter(), curve); }
+  static DxAxis* XRotation(const uint16_t* curve = 0) { return new DxAxis(new DxXRotAxisAdapter(), curve); }
+  static DxAxis* YRotation(const uint16_t* curve = 0) { return new DxAxis(new DxYRotAxisAdapter(), curve); }
+  static DxAxis* ZRotation(const uint16_t* curve = 0) { return new DxAxis(new DxZRotAxisAdapter(), curve); }
 
   void report(float val) {
     float clamped = min(max(val, 0.0), 1.0);
-    _adapter->report(clamped);
+    reportPosition(uint16_t(clamped * 65535));
+  }
+
+  /* Counts straight off an AnalogInput, 0 to AnalogCounts - 1. */
+  void reportCounts(uint16_t counts) {
+    // Stretched to 0-65535 without a multiply.
+    reportPosition((counts << 6) | (counts >> 4));
+  }
+
+  void reportPosition(uint16_t pos) {
+    if (_reported && pos == _last) {
+      ++axisReportsSkipped;
+      return;
+    }
+    _last = pos;
+    _reported = true;
+    if (_curve) {
+      pos = applyCurve(_curve, pos);
+    }
+    _adapter->report(pos);
   }
 };
 
@@ -163,6 +953,13 @@ class DxAxis {
 class DigitalInput : public Stateful {
  public:
   virtual bool read() = 0;
+
+  /* Arranges for a change on this input to mark component `owner` as
+     needing an update. False if it can't, in which case whoever's
+     reading it has to keep polling. */
+  virtual bool watch(byte owner) {
+    return false;
+  }
 };
 
 /* A place that can accept digital output. Abstract: might not be a
@@ -172,35 +969,477 @@ class DigitalOutput : public Stateful {
   virtual void write(bool val) = 0;
 };
 
+/* Analog inputs read in counts from 0 to AnalogCounts - 1, the same
+   as the ADC. */
+const int AnalogCounts = 1024;
+
 /* A source of analog input in the range 0.0 to 1.0, inclusive.
-   Abstract. */
+   Abstract. Underneath it's an integer count, and anything that can
+   get by with that should use readCounts() and skip the float. */
 class AnalogInput : public Stateful {
  public:
-  virtual float read() = 0;
+  virtual int readCounts() = 0;
+
+  virtual float read() {
+    return readCounts() * (1.0 / AnalogCounts);
+  }
+};
+
+/* Splits analog counts into `count` bands at a table of `count - 1`
+   boundaries, lowest first. Band 0 is everything below the first
+   boundary, and so on up. The table isn't copied, so it has to stay
+   put.
+
+   A reading that's hovering right on a boundary would flip between
+   the bands on either side, so once we're in a band, we stay in it
+   until the reading gets `hysteresis` counts past one of its edges.
+   Finding the new band is a binary search, so a dozen bands is four
+   compares. */
+class Bands {
+ private:
+  const int* _bounds;
+  byte _count;
+  int _hysteresis;
+
+ public:
+  Bands(const int* bounds, byte count, int hysteresis) {
+    _bounds = bounds;
+    _count = count;
+    _hysteresis = hysteresis;
+  }
+
+  byte count() {
+    return _count;
+  }
+
+  /* The band `counts` falls in, hysteresis or no. */
+  byte find(int counts) {
+    byte low = 0;
+    byte high = _count - 1;
+    while (low < high) {
+      byte mid = (low + high) / 2;
+      if (counts < _bounds[mid]) {
+        high = mid;
+      }
+      else {
+        low = mid + 1;
+      }
+    }
+    return low;
+  }
+
+  /* The band `counts` falls in, given that it was in band `current`
+     last time. */
+  byte decode(int counts, byte current) {
+    if (current < _count) {
+      bool aboveLow = current == 0 || counts >= _bounds[current - 1] - _hysteresis;
+      bool belowHigh = current == _count - 1 || counts < _bounds[current] + _hysteresis;
+      if (aboveLow && belowHigh) {
+        return current;
+      }
+    }
+    return find(counts);
+  }
 };
 
+/* Bands for readings that sit at known `levels`, in any order, with
+   the boundaries half way between neighbours. `owners` gets which
+   level each band belongs to, so it needs room for `count`. Sorting
+   is insertion sort, which is plenty for the handful of levels
+   anything has. */
+Bands* levelBands(const int* levels, byte count, int hysteresis, byte* owners) {
+  int* sorted = new int[count];
+  for (byte i = 0; i < count; ++i) {
+    byte j = i;
+    while (j > 0 && sorted[j - 1] > levels[i]) {
+      sorted[j] = sorted[j - 1];
+      owners[j] = owners[j - 1];
+      --j;
+    }
+    sorted[j] = levels[i];
+    owners[j] = i;
+  }
+
+  int* bounds = new int[count - 1];
+  for (byte i = 0; i + 1 < count; ++i) {
+    bounds[i] = (sorted[i] + sorted[i + 1] + 1) / 2;
+  }
+  delete[] sorted;
+  return new Bands(bounds, count, hysteresis);
+}
+
 /* A representation of a physical component in our game controller.
    Includes things like swpitches and knobs, but also things like
    mulitplexers. */
 class Component : public Stateful, public Updateable {
+ public:
+  /* Asks the component to tell the host its current state all over
+     again, via `queue`. Only components that latch, like the
+     switches, have anything to say. */
+  virtual void resync(PressQueue* queue) { }
+
+  /* Reads the component's inputs and takes them as its starting
+     state, without pressing anything. Called once after setup() so
+     the first scan doesn't announce every switch at once. */
+  virtual void snapshot() { }
+
+  /* Asks the component to watch its inputs for changes on behalf of
+     component number `id`. True if every input it has can tell us
+     when it changes, so the component only needs an update when one
+     does. The rest get updated every scan. */
+  virtual bool watch(byte id) {
+    return false;
+  }
+
+  /* True while the component has something to finish on its own, like
+     a MomentaryButton waiting to let go, and needs updating every
+     scan even though its inputs are still. */
+  virtual bool busy() {
+    return false;
+  }
+
+  /* True if the component can sit out a few scans when the loop's
+     running late - the pots, which nobody notices lagging a little.
+     A momentary button of its own can stay down that much longer. */
+  virtual bool sheddable() {
+    return false;
+  }
+
+  /* Adds anything the component has to say for itself to the end of
+     its line in the 'k' dump, starting with a comma. Keep it short. */
+  virtual void status(Print* out) { }
+};
+
+void pinWatchChanged();
+
+/* Pins that interrupt when they change, and the components that are
+   waiting to hear about it. Pins with a pin-change interrupt use
+   that; pins with an external interrupt use attachInterrupt(). On a
+   Leonardo that's 7, 8, 9, 10, 11 and 14-17, plus 0-3 if the serial
+   port and I2C aren't using them.
+
+   The interrupt just notes which components' pins have changed, as a
+   bit per component, and the loop picks those up with take(). Only the
+   first 32 components can be watched.
+
+   On an AVR, the pin-change interrupts are the HAL's, so this won't
+   get along with a library that wants them too, like SoftwareSerial. */
+class PinWatch {
+ private:
+  struct Watched {
+    HalPin pin;
+    bool level;
+    unsigned long owner;
+  };
+
+  static const byte Capacity = 16;
+  Watched _pins[Capacity];
+  volatile byte _count;
+  volatile unsigned long _dirty;
+  volatile unsigned long _since;
+
+ public:
+  PinWatch() {
+    _count = 0;
+    _dirty = 0;
+    _since = 0;
+  }
+
+  bool watch(int pin, byte owner) {
+    if (owner >= 32 || _count == Capacity) {
+      return false;
+    }
+    Watched* watched = &_pins[_count];
+    watched->pin = halPin(pin);
+    watched->level = halReadPin(watched->pin);
+    watched->owner = 1UL << owner;
+    ++_count;
+
+    if (!halAttachChange(pin, pinWatchChanged)) {
+      --_count;
+      return false;
+    }
+    return true;
+  }
+
+  /* Called from the interrupts. Looks at every watched pin rather than
+     working out which one it was, which with a dozen pins is quicker
+     than it sounds. */
+  void changed() {
+    for (byte i = 0; i < _count; ++i) {
+      bool level = halReadPin(_pins[i].pin);
+      if (level != _pins[i].level) {
+        _pins[i].level = level;
+        if (!_dirty) {
+          _since = microClock.us();
+        }
+        _dirty |= _pins[i].owner;
+      }
+    }
+  }
+
+  bool pending() {
+    return _dirty != 0;
+  }
+
+  /* Marks component `owner` as needing an update, as if one of its
+     pins had changed. For inputs that need another look later. */
+  void poke(byte owner) {
+    if (owner >= 32) {
+      return;
+    }
+    noInterrupts();
+    if (!_dirty) {
+      _since = microClock.us();
+    }
+    _dirty |= 1UL << owner;
+    interrupts();
+  }
+
+  /* The components whose pins have changed since the last call, one
+     bit each. If `since` is given, it gets the microClock.us() of the first
+     of those changes. */
+  unsigned long take(unsigned long* since = 0) {
+    noInterrupts();
+    unsigned long dirty = _dirty;
+    _dirty = 0;
+    if (since) {
+      *since = _since;
+    }
+    interrupts();
+    return dirty;
+  }
 };
 
+PinWatch pinWatch;
+
+void pinWatchChanged() {
+  pinWatch.changed();
+}
+
+class IC74LS151;
+
+void samplerTick();
+
+const byte SampledPorts = 6;
+const byte SampledMuxes = 4;
+const byte SampledAnalogs = 8;
+const byte NotSampled = 0xFF;
+
+/* Everything the inputs had to say at one moment: the input register
+   of every port with a pin we read, all eight lines of every mux, and
+   the most recent reading of every analog pin. */
+struct Snapshot {
+  byte ports[SampledPorts];
+  byte muxes[SampledMuxes];
+  int analogs[SampledAnalogs];
+  unsigned long time;
+};
+
+/* Samples every input from a timer interrupt, at a fixed rate, so
+   when a switch gets read doesn't depend on how long the components
+   ahead of it took. The interrupt fills in a Snapshot, and the loop
+   takes the latest complete one with acquire() at the top of each
+   scan; the inputs then read from that instead of from the pins.
+
+   There are two snapshots. The interrupt always writes the one the
+   loop isn't holding, so a scan never sees one half-written, and all
+   its components see the same moment.
+
+   The analog pins take turns: each interrupt collects the conversion
+   the last one started and starts the next, so nobody waits on the
+   ADC. With four pots at 500Hz, each is read 125 times a second.
+
+   Inputs sign up in their setup(), and read the pins directly until
+   start() is called. A digital input there's no room for reads its
+   pin directly all along. An analog one can't: the interrupt has the
+   ADC, and a conversion of its own would spoil the interrupt's. So
+   it's turned away, reads 0, and gets counted in analogsRefused().
+
+   The sampler needs the HAL's timer interrupt, whole-port reads and
+   an ADC that converts on its own, which only an AVR has: elsewhere
+   start() does nothing, and the inputs always read the pins. On an
+   AVR the timer is Timer1, so it won't get along with the Servo
+   library. */
+class Sampler {
+ private:
+  HalPort _ports[SampledPorts];
+  byte _portCount;
+  IC74LS151* _muxes[SampledMuxes];
+  byte _muxCount;
+  byte _analogPins[SampledAnalogs];
+  int _analogs[SampledAnalogs];
+  byte _analogCount;
+  byte _analogsRefused;
+  byte _nextAnalog;
+  bool _converting;
+  Snapshot _snapshots[2];
+  volatile byte _latest;
+  volatile byte _held;
+  volatile bool _sampling;
+  bool _running;
+
+  void sampleAnalogs() {
+    if (_converting && halAnalogDone()) {
+      _analogs[_nextAnalog] = halAnalogResult();
+      _nextAnalog = (_nextAnalog + 1) % _analogCount;
+      _converting = false;
+    }
+    if (!_converting) {
+      halAnalogStart(_analogPins[_nextAnalog]);
+      _converting = true;
+    }
+  }
+
+ public:
+  Sampler() {
+    _portCount = 0;
+    _muxCount = 0;
+    _analogCount = 0;
+    _analogsRefused = 0;
+    _nextAnalog = 0;
+    _converting = false;
+    memset(_snapshots, 0, sizeof(_snapshots));
+    _latest = 0;
+    _held = 0;
+    _sampling = false;
+    _running = false;
+  }
+
+  /* These return where to find the input in a Snapshot, or NotSampled
+     if there's no room. */
+  byte addPin(int pin) {
+    HalPort port;
+    if (!halPort(pin, &port)) {
+      return NotSampled;
+    }
+    for (byte i = 0; i < _portCount; ++i) {
+      if (_ports[i] == port) {
+        return i;
+      }
+    }
+    if (_running || _portCount == SampledPorts) {
+      return NotSampled;
+    }
+    _ports[_portCount] = port;
+    return _portCount++;
+  }
+
+  byte addMux(IC74LS151* mux) {
+    if (_running || _muxCount == SampledMuxes) {
+      return NotSampled;
+    }
+    _muxes[_muxCount] = mux;
+    return _muxCount++;
+  }
+
+  byte addAnalog(byte pin) {
+    if (_running || _analogCount == SampledAnalogs) {
+      ++_analogsRefused;
+      return NotSampled;
+    }
+    _analogPins[_analogCount] = pin;
+    _analogs[_analogCount] = halAnalogRead(pin);
+    return _analogCount++;
+  }
+
+  /* Starts sampling `rate` times a second. */
+  void start(unsigned int rate) {
+    noInterrupts();
+    if (halTickStart(rate, samplerTick)) {
+      _running = true;
+      sample();
+      _held = _latest;
+    }
+    interrupts();
+  }
+
+  /* True if inputs should read from the held snapshot. Not while
+     we're taking one: then they have to go to the pins. */
+  bool active() {
+    return _running && !_sampling;
+  }
+
+  /* Called from the timer interrupt. */
+  void sample();
+
+  /* Holds on to the latest complete snapshot for the inputs to read.
+     With `fresh`, takes a new one first, for when a pin change says
+     the latest is already out of date. */
+  void acquire(bool fresh = false) {
+    if (!_running) {
+      return;
+    }
+    noInterrupts();
+    if (fresh) {
+      sample();
+    }
+    _held = _latest;
+    interrupts();
+  }
+
+  const Snapshot* held() {
+    return &_snapshots[_held];
+  }
+
+  /* How much of a Snapshot is in use. */
+  byte portCount() {
+    return _portCount;
+  }
+
+  byte muxCount() {
+    return _muxCount;
+  }
+
+  byte analogCount() {
+    return _analogCount;
+  }
+
+  /* True if the interrupt is using the ADC, so nobody else can. */
+  bool ownsAdc() {
+    return _running && _analogCount > 0;
+  }
+
+  /* How many analog inputs were turned away. */
+  byte analogsRefused() {
+    return _analogsRefused;
+  }
+};
+
+Sampler sampler;
+
+void samplerTick() {
+  sampler.sample();
+}
+
 /* A pin on the Arduino that we want to use as a digital input,
    configured with a pullup resistor. */
 class DigitalInputPullupPin : public DigitalInput, public Stateful {
  private:
   int _pin;
+  HalPin _fast;
+  byte _port;
 
  public:
   DigitalInputPullupPin(int pin) {
     _pin = pin;
+    _port = NotSampled;
   }
   virtual bool read() {
-    return digitalRead(_pin);
+    if (_port != NotSampled && sampler.active()) {
+      return sampler.held()->ports[_port] & halPortMask(_fast);
+    }
+    return halReadPin(_fast);
   }
 
   virtual void setup() {
-    pinMode(_pin, INPUT_PULLUP);
+    halInputPullup(_pin);
+    _fast = halPin(_pin);
+    _port = sampler.addPin(_pin);
+  }
+
+  virtual bool watch(byte owner) {
+    return pinWatch.watch(_pin, owner);
   }
 };
 
@@ -214,11 +1453,11 @@ class DigitalOutputPin : public DigitalOutput, public Stateful {
   }
 
   virtual void write(bool val) {
-    digitalWrite(_pin, val ? HIGH : LOW);
+    halWrite(_pin, val);
   }
 
   virtual void setup() {
-    pinMode(_pin, OUTPUT);
+    halOutput(_pin);
   }
 };
 
@@ -226,17 +1465,27 @@ class DigitalOutputPin : public DigitalOutput, public Stateful {
 class AnalogInputPin : public AnalogInput {
  private:
   int _pin;
+  byte _slot;
 
  public:
   AnalogInputPin(int pin) {
     _pin = pin;
+    _slot = NotSampled;
   }
 
   virtual void setup() {
+    _slot = sampler.addAnalog(_pin);
   }
 
-  virtual float read() {
-    return float(analogRead(_pin)) / 1024.0;
+  virtual int readCounts() {
+    if (_slot != NotSampled && sampler.active()) {
+      return sampler.held()->analogs[_slot];
+    }
+    if (_slot == NotSampled && sampler.ownsAdc()) {
+      // Turned away; see Sampler.
+      return 0;
+    }
+    return halAnalogRead(_pin);
   }
 };
 
@@ -258,13 +1507,369 @@ class PushButton : public Component {
     _in->setup();
   }
 
+  virtual bool watch(byte id) {
+    return _in->watch(id);
+  }
+
+  virtual bool busy() {
+    return _button->busy();
+  }
+
   virtual void update() {
     _button->update();
     if (_in->read()) {
       _button->release();
     }
-    else {
-      _button->press();
+    else {
+      _button->press();
+    }
+  }
+};
+
+/* A physical pushbutton that tells a tap, a hold and a double-tap
+   apart and presses a different button for each. All the thresholds
+   are in milliseconds off panelClock, so they don't change when the
+   scan rate does. Any of the buttons can be null if you don't care
+   about that gesture.
+
+   The hold button stays pressed for as long as the physical one does.
+   The tap and double-tap buttons are only ever pressed, so wrap them
+   in a MomentaryButton; otherwise they're released when the next
+   gesture starts. */
+class GestureButton : public Component, public Timer {
+ private:
+  enum State : byte {
+    Idle, Pressed, Held, Released, PressedAgain
+  };
+
+  DigitalInput* _in;
+  Button* _tap;
+  Button* _hold;
+  Button* _doubleTap;
+  unsigned int _holdMs;
+  unsigned int _doubleMs;
+  State _state;
+  bool _down;
+  unsigned long _releasedAt;
+  unsigned long _lastTapLatency;
+  unsigned long _maxTapLatency;
+
+  static void updateIf(Button* button) {
+    if (button) {
+      button->update();
+    }
+  }
+
+  static bool busyIf(Button* button) {
+    return button && button->busy();
+  }
+
+  static void pressIf(Button* button) {
+    if (button) {
+      button->press();
+    }
+  }
+
+  static void releaseIf(Button* button) {
+    if (button) {
+      button->release();
+    }
+  }
+
+  void fireTap() {
+    _lastTapLatency = panelClock.now() - _releasedAt;
+    _maxTapLatency = max(_maxTapLatency, _lastTapLatency);
+    pressIf(_tap);
+  }
+
+ public:
+  GestureButton(DigitalInput* in, Button* tap, Button* hold, Button* doubleTap,
+                unsigned int holdMs = 500, unsigned int doubleMs = 250) {
+    _in = in;
+    _tap = tap;
+    _hold = hold;
+    _doubleTap = doubleTap;
+    _holdMs = holdMs;
+    _doubleMs = doubleMs;
+    _state = Idle;
+    _down = false;
+    _releasedAt = 0;
+    _lastTapLatency = 0;
+    _maxTapLatency = 0;
+  }
+
+  virtual void setup() {
+    _in->setup();
+  }
+
+  virtual bool watch(byte id) {
+    return _in->watch(id);
+  }
+
+  virtual bool busy() {
+    return busyIf(_tap) || busyIf(_hold) || busyIf(_doubleTap);
+  }
+
+  virtual void snapshot() {
+    _down = !_in->read();
+  }
+
+  /* How long, in milliseconds, between letting go of the button and
+     the tap being recognized. Without a double-tap button this is
+     just the scan-to-scan jitter; with one, it's bounded by doubleMs
+     plus one pass through the loop. */
+  unsigned long lastTapLatency() {
+    return _lastTapLatency;
+  }
+
+  unsigned long maxTapLatency() {
+    return _maxTapLatency;
+  }
+
+  virtual void status(Print* out) {
+    out->print(F(", tap latency "));
+    out->print(_lastTapLatency);
+    out->print(F("ms, worst "));
+    out->print(_maxTapLatency);
+    out->print(F("ms"));
+  }
+
+  virtual void update() {
+    updateIf(_tap);
+    updateIf(_hold);
+    updateIf(_doubleTap);
+
+    bool down = !_in->read();
+    if (down == _down) {
+      return;
+    }
+    _down = down;
+
+    if (down) {
+      if (_state == Idle) {
+        releaseIf(_tap);
+        releaseIf(_doubleTap);
+        _state = Pressed;
+        if (_hold) {
+          timers.schedule(this, _holdMs);
+        }
+      }
+      else if (_state == Released) {
+        timers.cancel(this);
+        pressIf(_doubleTap);
+        _state = PressedAgain;
+      }
+    }
+    else {
+      if (_state == Pressed) {
+        timers.cancel(this);
+        _releasedAt = panelClock.now();
+        if (_doubleTap) {
+          _state = Released;
+          timers.schedule(this, _doubleMs);
+        }
+        else {
+          fireTap();
+          _state = Idle;
+        }
+      }
+      else if (_state == Held) {
+        releaseIf(_hold);
+        _state = Idle;
+      }
+      else if (_state == PressedAgain) {
+        _state = Idle;
+      }
+    }
+  }
+
+  virtual void expire() {
+    if (_state == Pressed) {
+      pressIf(_hold);
+      _state = Held;
+    }
+    else if (_state == Released) {
+      fireTap();
+      _state = Idle;
+    }
+  }
+};
+
+/* A group of up to eight momentary inputs that press one button each
+   on their own, but a different button when several are pressed
+   together. The inputs are read into a bitmask (input 0 is bit 0),
+   and chords are looked up in a table indexed by that mask, so
+   matching costs the same however many chords there are. The table
+   has 2^count entries, so keep count down to what you need.
+
+   Inputs pressed within `windowMs` of the first one count as being
+   pressed together. Nothing is pressed until the window closes (or
+   something is let go early); at that point either the chord's
+   button is pressed and the individual ones are suppressed until
+   every input is released, or the individual buttons take over and
+   track their inputs. */
+class ChordedButtons : public Component, public Timer {
+ private:
+  enum State : byte {
+    Idle, Gathering, Chorded, Single
+  };
+
+  DigitalInput** _ins;
+  Button** _buttons;
+  byte _count;
+  byte* _chordIndex;
+  Button** _chords;
+  byte _chordCount;
+  byte _maxChords;
+  unsigned int _windowMs;
+  State _state;
+  byte _seen;
+  byte _pressed;
+  Button* _active;
+
+  byte readMask() {
+    byte mask = 0;
+    for (byte i = 0; i < _count; ++i) {
+      if (!_ins[i]->read()) {
+        mask |= 1 << i;
+      }
+    }
+    return mask;
+  }
+
+  /* Makes the individual buttons match `mask`, touching only the ones
+     that changed. */
+  void track(byte mask) {
+    byte changed = mask ^ _pressed;
+    for (byte i = 0; changed; ++i, changed >>= 1) {
+      if ((changed & 1) && _buttons[i]) {
+        setButton(_buttons[i], bitRead(mask, i));
+      }
+    }
+    _pressed = mask;
+  }
+
+  void decide() {
+    timers.cancel(this);
+    byte index = _chordIndex[_seen];
+    if (index) {
+      _active = _chords[index - 1];
+      _active->press();
+      _state = Chorded;
+    }
+    else {
+      track(_seen);
+      _state = Single;
+    }
+  }
+
+ public:
+  ChordedButtons(DigitalInput** ins, Button** buttons, byte count,
+                 byte maxChords, unsigned int windowMs = 60) {
+    _ins = ins;
+    _buttons = buttons;
+    _count = min(count, 8);
+    _chordIndex = new byte[1 << _count];
+    memset(_chordIndex, 0, 1 << _count);
+    _chords = new Button*[maxChords];
+    _chordCount = 0;
+    _maxChords = maxChords;
+    _windowMs = windowMs;
+    _state = Idle;
+    _seen = 0;
+    _pressed = 0;
+    _active = 0;
+  }
+
+  /* Presses `button` when exactly the inputs in `mask` are pressed
+     together. */
+  void addChord(byte mask, Button* button) {
+    if (_chordCount < _maxChords && mask < (1 << _count)) {
+      _chords[_chordCount++] = button;
+      _chordIndex[mask] = _chordCount;
+    }
+  }
+
+  virtual void setup() {
+    for (byte i = 0; i < _count; ++i) {
+      _ins[i]->setup();
+    }
+  }
+
+  virtual bool watch(byte id) {
+    bool all = true;
+    for (byte i = 0; i < _count; ++i) {
+      if (!_ins[i]->watch(id)) {
+        all = false;
+      }
+    }
+    return all;
+  }
+
+  virtual bool busy() {
+    for (byte i = 0; i < _count; ++i) {
+      if (_buttons[i] && _buttons[i]->busy()) {
+        return true;
+      }
+    }
+    for (byte i = 0; i < _chordCount; ++i) {
+      if (_chords[i]->busy()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  virtual void update() {
+    for (byte i = 0; i < _count; ++i) {
+      if (_buttons[i]) {
+        _buttons[i]->update();
+      }
+    }
+    for (byte i = 0; i < _chordCount; ++i) {
+      _chords[i]->update();
+    }
+
+    byte mask = readMask();
+
+    switch (_state) {
+    case Idle:
+      if (mask) {
+        _seen = mask;
+        _state = Gathering;
+        timers.schedule(this, _windowMs);
+      }
+      break;
+    case Gathering:
+      // Letting go of anything means the chord is as big as it's
+      // going to get.
+      if (_seen & ~mask) {
+        decide();
+      }
+      else {
+        _seen |= mask;
+      }
+      break;
+    case Chorded:
+      if (!mask) {
+        _active->release();
+        _state = Idle;
+      }
+      break;
+    case Single:
+      if (mask != _pressed) {
+        track(mask);
+      }
+      if (!mask) {
+        _state = Idle;
+      }
+      break;
+    }
+  }
+
+  virtual void expire() {
+    if (_state == Gathering) {
+      decide();
     }
   }
 };
@@ -301,22 +1906,38 @@ class OnOffOnSwitch : public Component {
     _inDown->setup();
   }
 
-  virtual void update() {
-    int current;
-    _buttonUp->update();
-    _buttonMiddle->update();
-    _buttonDown->update();
+  virtual bool watch(byte id) {
+    bool up = _inUp->watch(id);
+    bool down = _inDown->watch(id);
+    return up && down;
+  }
+
+  virtual bool busy() {
+    return _buttonUp->busy() || _buttonMiddle->busy() || _buttonDown->busy();
+  }
 
+  int position() {
     if (!_inUp->read()) {
-      current = UP;
+      return UP;
     }
     else if (!_inDown->read()) {
-      current = DOWN;
+      return DOWN;
     }
     else {
-      current = MIDDLE;
+      return MIDDLE;
     }
+  }
+
+  virtual void snapshot() {
+    _last = position();
+  }
+
+  virtual void update() {
+    _buttonUp->update();
+    _buttonMiddle->update();
+    _buttonDown->update();
 
+    int current = position();
     if (current != _last) {
       setButton(_buttonUp, current == UP);
       setButton(_buttonMiddle, current == MIDDLE);
@@ -324,6 +1945,18 @@ class OnOffOnSwitch : public Component {
       _last = current;
     }
   }
+
+  virtual void resync(PressQueue* queue) {
+    if (_last == UP) {
+      queue->enqueue(_buttonUp);
+    }
+    else if (_last == MIDDLE) {
+      queue->enqueue(_buttonMiddle);
+    }
+    else if (_last == DOWN) {
+      queue->enqueue(_buttonDown);
+    }
+  }
 };
 
 /* A physical, on-off, non-momentary switch that will generate presses
@@ -346,25 +1979,87 @@ class OnOffSwitch : public Component {
     _in->setup();
   }
 
-  virtual void update() {
-    int current;
+  virtual bool watch(byte id) {
+    return _in->watch(id);
+  }
+
+  virtual bool busy() {
+    return _buttonUp->busy() || _buttonDown->busy();
+  }
+
+  int position() {
+    return _in->read() ? DOWN : UP;
+  }
+
+  virtual void snapshot() {
+    _last = position();
+  }
 
+  virtual void update() {
     _buttonUp->update();
     _buttonDown->update();
 
-    if (!_in->read()) {
-      current = UP;
-    }
-    else {
-      current = DOWN;
-    }
-
+    int current = position();
     if (current != _last) {
       setButton(_buttonUp, current == UP);
       setButton(_buttonDown, current == DOWN);
       _last = current;
     }
   }
+
+  virtual void resync(PressQueue* queue) {
+    if (_last == UP) {
+      queue->enqueue(_buttonUp);
+    }
+    else if (_last == DOWN) {
+      queue->enqueue(_buttonDown);
+    }
+  }
+};
+
+/* A pushbutton that asks for the whole panel to be resynced with the
+   sim - handy after a mission loads with every switch in the wrong
+   place. It doesn't press anything itself; the loop checks
+   requested() and does the resync. */
+class SyncButton : public Component {
+ private:
+  DigitalInput* _in;
+  bool _down;
+  bool _requested;
+
+ public:
+  SyncButton(DigitalInput* in) {
+    _in = in;
+    _down = false;
+    _requested = false;
+  }
+
+  virtual void setup() {
+    _in->setup();
+  }
+
+  virtual bool watch(byte id) {
+    return _in->watch(id);
+  }
+
+  virtual void snapshot() {
+    _down = !_in->read();
+  }
+
+  virtual void update() {
+    bool down = !_in->read();
+    if (down && !_down) {
+      _requested = true;
+    }
+    _down = down;
+  }
+
+  /* True once per press. */
+  bool requested() {
+    bool requested = _requested;
+    _requested = false;
+    return requested;
+  }
 };
 
 /* Adapts a simple potentiometer into a DX axis and two DirectX
@@ -372,12 +2067,14 @@ class OnOffSwitch : public Component {
    through a configurable threshold in the on and off directions. */
 class SwitchingRotary : public Component {
  private:
-  float _last;
+  int _last;
+  int _axisCounts;
   AnalogInput* _in;
   Button* _buttonOn;
   Button* _buttonOff;
   DxAxis* _dxAxis;
-  float _threshold;
+  // In counts, so an update is all integer compares.
+  int _threshold;
 
  public:
   SwitchingRotary(AnalogInput* in,
@@ -387,7 +2084,8 @@ class SwitchingRotary : public Component {
     _buttonOn = buttonOn;
     _buttonOff = buttonOff;
     _last = -1;
-    _threshold = threshold;
+    _axisCounts = -1;
+    _threshold = int(threshold * AnalogCounts + 0.5);
     _dxAxis = dxAxis;
   }
 
@@ -395,31 +2093,125 @@ class SwitchingRotary : public Component {
     _in->setup();
   }
 
+  virtual bool sheddable() {
+    return true;
+  }
+
+  virtual void snapshot() {
+    _last = _in->readCounts();
+  }
+
   virtual void update() {
     _buttonOn->update();
     _buttonOff->update();
-    float val = _in->read();
+    int counts = _in->readCounts();
 
-    if ((val >= _threshold) && (_last < _threshold)) {
+    if ((counts >= _threshold) && (_last < _threshold)) {
       _buttonOn->press();
       _buttonOff->release();
     }
-    else if ((val <= _threshold) && (_last > _threshold)) {
+    else if ((counts <= _threshold) && (_last > _threshold)) {
       _buttonOn->release();
       _buttonOff->press();
     }
+    _last = counts;
 
-    if (val >= _threshold) {
-      // Scale the reported value from 0.0 at the threshold to 1.0 at
+    if (counts == _axisCounts) {
+      ++axisReportsSkipped;
+      return;
+    }
+    _axisCounts = counts;
+    if (counts >= _threshold) {
+      // Scale the reported value from 0 at the threshold to 65535 at
       // the max.
-      float scaled = (val - _threshold) / (1.0 - _threshold);
-      _dxAxis->report(scaled);
+      long span = AnalogCounts - 1 - _threshold;
+      _dxAxis->reportPosition(span > 0 ? (counts - _threshold) * 65535L / span : 65535);
     }
     else {
-      _dxAxis->report(0.0);
+      _dxAxis->reportPosition(0);
+    }
+  }
+};
+
+/* A pot used as a selector: its travel is split into `zones`, and
+   turning it into a zone presses that zone's button and releases the
+   last one's. `bounds` are the `zones - 1` boundaries between them,
+   in counts, lowest first; leave it null to split the travel evenly.
+   A reading has to get `hysteresis` counts past a boundary to cross
+   it, so a knob left on one doesn't flicker between two zones.
+
+   `dxAxis` can be null. If it isn't, it gets the pot's position as
+   well, all the way from one end to the other. */
+class ZonedRotary : public Component {
+ private:
+  AnalogInput* _in;
+  Bands* _bands;
+  Button** _buttons;
+  DxAxis* _dxAxis;
+  byte _zone;
+
+ public:
+  ZonedRotary(AnalogInput* in, byte zones, Button** buttons,
+              DxAxis* dxAxis = 0, const int* bounds = 0, int hysteresis = 8) {
+    _in = in;
+    _buttons = buttons;
+    _dxAxis = dxAxis;
+    if (!bounds) {
+      int* even = new int[zones - 1];
+      for (byte i = 0; i + 1 < zones; ++i) {
+        even[i] = long(AnalogCounts) * (i + 1) / zones;
+      }
+      bounds = even;
+    }
+    _bands = new Bands(bounds, zones, hysteresis);
+    _zone = 0;
+  }
+
+  virtual void setup() {
+    _in->setup();
+  }
+
+  virtual bool sheddable() {
+    return true;
+  }
+
+  virtual bool busy() {
+    for (byte i = 0; i < _bands->count(); ++i) {
+      if (_buttons[i]->busy()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  byte zone() {
+    return _zone;
+  }
+
+  virtual void snapshot() {
+    _zone = _bands->find(_in->readCounts());
+  }
+
+  virtual void update() {
+    for (byte i = 0; i < _bands->count(); ++i) {
+      _buttons[i]->update();
+    }
+
+    int counts = _in->readCounts();
+    byte zone = _bands->decode(counts, _zone);
+    if (zone != _zone) {
+      _buttons[_zone]->release();
+      _buttons[zone]->press();
+      _zone = zone;
     }
 
-    _last = val;
+    if (_dxAxis) {
+      _dxAxis->reportCounts(counts);
+    }
+  }
+
+  virtual void resync(PressQueue* queue) {
+    queue->enqueue(_buttons[_zone]);
   }
 };
 
@@ -466,6 +2258,15 @@ class PulseRotary : public Component {
     _in->setup();
   }
 
+  virtual bool sheddable() {
+    return true;
+  }
+
+  virtual void snapshot() {
+    _last = _in->read();
+    updateThresholds();
+  }
+
   bool between(float val, float low, float high) {
     return (val >= low) && (val <= high);
   }
@@ -646,6 +2447,11 @@ class RotaryEncoder : public Component {
     _in2->setup();
   }
 
+  virtual void snapshot() {
+    _last1 = _in1->read();
+    _last2 = _in2->read();
+  }
+
   virtual void update() {
     bool val1 = _in1->read();
     bool val2 = _in2->read();
@@ -721,10 +2527,12 @@ class IC74LS151 : public Component {
   DigitalOutput* _dout1;
   DigitalOutput* _dout2;
   DigitalInput* _din;
+  byte _slot;
 
   /* Adapts a LS151 mux to another control by satisfying the DigitalInput contract. */
   class IC54LS151InputLine : public DigitalInput {
   private:
+    byte _addr;
     bool _addr0;
     bool _addr1;
     bool _addr2;
@@ -733,12 +2541,16 @@ class IC74LS151 : public Component {
   public:
     IC54LS151InputLine(IC74LS151* mux, byte addr) {
       _mux = mux;
+      _addr = addr;
       _addr0 = bitRead(addr, 0) == 1;
       _addr1 = bitRead(addr, 1) == 1;
       _addr2 = bitRead(addr, 2) == 1;
     }
 
     virtual bool read() {
+      if (_mux->_slot != NotSampled && sampler.active()) {
+        return bitRead(sampler.held()->muxes[_mux->_slot], _addr);
+      }
       return _mux->read(_addr0, _addr1, _addr2);
     }
 
@@ -759,6 +2571,7 @@ class IC74LS151 : public Component {
     _dout1 = dout1;
     _dout2 = dout2;
     _din = din;
+    _slot = NotSampled;
   }
 
   virtual void setup() {
@@ -766,6 +2579,37 @@ class IC74LS151 : public Component {
     _dout1->setup();
     _dout2->setup();
     _din->setup();
+    _slot = sampler.addMux(this);
+  }
+
+  /* Reads all eight lines, one bit each, for the Sampler. The lines
+     go in Gray code order, so only one address pin changes between
+     one line and the next. */
+  byte sample() {
+    static const byte order[] = { 0, 1, 3, 2, 6, 7, 5, 4 };
+    byte lines = 0;
+    _dout0->write(LOW);
+    _dout1->write(LOW);
+    _dout2->write(LOW);
+    for (byte i = 0; i < 8; ++i) {
+      byte addr = order[i];
+      if (i > 0) {
+        byte changed = addr ^ order[i - 1];
+        if (changed & 1) {
+          _dout0->write(addr & 1 ? HIGH : LOW);
+        }
+        else if (changed & 2) {
+          _dout1->write(addr & 2 ? HIGH : LOW);
+        }
+        else {
+          _dout2->write(addr & 4 ? HIGH : LOW);
+        }
+      }
+      if (_din->read()) {
+        lines |= 1 << addr;
+      }
+    }
+    return lines;
   }
 
   virtual void update() {
@@ -776,4 +2620,392 @@ class IC74LS151 : public Component {
   }
 
 };
+
+/* Several buttons on one analog pin. Each button connects the pin to a
+   different point on a chain of resistors, so each one reads as a
+   different voltage, and the pin reads `released` when none of them
+   is pressed - all the way up, usually, with a pull-up. `levels` are
+   what the pin reads with each button held, in counts. They can be in
+   any order; button n is `input(n)`, which reads LOW while it's
+   pressed, same as a switch on a pull-up pin.
+
+   The readings are split into bands half way between neighbouring
+   levels, with `hysteresis` counts of slack around each boundary (see
+   Bands). A button on its way down drags the reading through the
+   levels of other buttons, so a new band only counts once it's been
+   read `settleReads` scans running, without moving more than
+   `hysteresis` counts between them. That costs a scan of latency.
+
+   Only one button at a time: two together read as something else
+   entirely. Like the mux, it has to come before the components that
+   read it in the components array. */
+class ResistorLadder : public Component {
+ private:
+  static const byte NoButton = 0xFF;
+
+  AnalogInput* _in;
+  Bands* _bands;
+  byte* _buttons;
+  int _hysteresis;
+  byte _settleReads;
+  byte _band;
+  byte _candidate;
+  byte _seen;
+  int _lastCounts;
+
+  class LadderLine : public DigitalInput {
+   private:
+    ResistorLadder* _ladder;
+    byte _button;
+
+   public:
+    LadderLine(ResistorLadder* ladder, byte button) {
+      _ladder = ladder;
+      _button = button;
+    }
+
+    virtual bool read() {
+      return _ladder->pressed() != _button;
+    }
+
+    virtual void setup() {
+    }
+  };
+
+ public:
+  ResistorLadder(AnalogInput* in, const int* levels, byte buttons,
+                 int released = AnalogCounts - 1,
+                 int hysteresis = 8, byte settleReads = 2) {
+    _in = in;
+    _hysteresis = hysteresis;
+    _settleReads = settleReads;
+
+    int* all = new int[buttons + 1];
+    memcpy(all, levels, buttons * sizeof(int));
+    all[buttons] = released;
+    _buttons = new byte[buttons + 1];
+    _bands = levelBands(all, buttons + 1, hysteresis, _buttons);
+    delete[] all;
+
+    // The band for `released` belongs to no button.
+    _band = _bands->find(released);
+    _buttons[_band] = NoButton;
+    _candidate = _band;
+    _seen = 0;
+    _lastCounts = released;
+  }
+
+  virtual void setup() {
+    _in->setup();
+  }
+
+  virtual void snapshot() {
+    _lastCounts = _in->readCounts();
+    _band = _bands->find(_lastCounts);
+    _candidate = _band;
+  }
+
+  virtual void update() {
+    int counts = _in->readCounts();
+    bool steady = abs(counts - _lastCounts) <= _hysteresis;
+    _lastCounts = counts;
+
+    byte band = _bands->decode(counts, _band);
+    if (band == _band) {
+      _candidate = _band;
+      _seen = 0;
+    }
+    else {
+      if (band != _candidate || !steady) {
+        _candidate = band;
+        _seen = 0;
+      }
+      if (++_seen >= _settleReads) {
+        _band = band;
+        _seen = 0;
+      }
+    }
+  }
+
+  /* The button that's pressed, or 0xFF for none. */
+  byte pressed() {
+    return _buttons[_band];
+  }
+
+  DigitalInput* input(byte button) {
+    return new LadderLine(this, button);
+  }
+};
+
+/* Where a selector knob is pointing, from 0 to count() - 1, or
+   NoPosition while it's between two positions: most selectors break
+   one contact before making the next. Abstract, since there's more
+   than one way to wire them. */
+const byte NoPosition = 0xFF;
+
+class Positions : public Stateful {
+ public:
+  virtual byte count() = 0;
+  virtual byte read() = 0;
+
+  virtual bool watch(byte owner) {
+    return false;
+  }
+};
+
+/* A selector with a contact per position, each on its own input,
+   which reads LOW when the knob's there. */
+class OneHotPositions : public Positions {
+ private:
+  DigitalInput** _inputs;
+  byte _count;
+
+ public:
+  OneHotPositions(DigitalInput** inputs, byte count) {
+    _inputs = inputs;
+    _count = count;
+  }
+
+  virtual void setup() {
+    for (byte i = 0; i < _count; ++i) {
+      _inputs[i]->setup();
+    }
+  }
+
+  virtual bool watch(byte owner) {
+    bool all = true;
+    for (byte i = 0; i < _count; ++i) {
+      all = _inputs[i]->watch(owner) && all;
+    }
+    return all;
+  }
+
+  virtual byte count() {
+    return _count;
+  }
+
+  virtual byte read() {
+    byte position = NoPosition;
+    for (byte i = 0; i < _count; ++i) {
+      if (!_inputs[i]->read()) {
+        if (position != NoPosition) {
+          // Two at once: we're half way between them.
+          return NoPosition;
+        }
+        position = i;
+      }
+    }
+    return position;
+  }
+};
+
+/* A selector whose contacts make a number, one input per bit, least
+   significant first, each reading LOW for a 1. The number's looked up
+   in a table that's built once, so any codes that aren't a position
+   - what a binary-coded switch reads for a moment between positions,
+   say - come out as NoPosition. With `gray` set, the positions count
+   in Gray code, where only one bit changes from one position to the
+   next, so there's nothing to misread on the way. */
+class CodedPositions : public Positions {
+ private:
+  DigitalInput** _bits;
+  byte _bitCount;
+  byte _count;
+  byte* _table;
+
+ public:
+  CodedPositions(DigitalInput** bits, byte bitCount, byte count, bool gray = true) {
+    _bits = bits;
+    _bitCount = bitCount;
+    _count = count;
+    _table = new byte[1 << bitCount];
+    memset(_table, NoPosition, 1 << bitCount);
+    for (byte position = 0; position < count; ++position) {
+      _table[gray ? position ^ (position >> 1) : position] = position;
+    }
+  }
+
+  virtual void setup() {
+    for (byte i = 0; i < _bitCount; ++i) {
+      _bits[i]->setup();
+    }
+  }
+
+  virtual bool watch(byte owner) {
+    bool all = true;
+    for (byte i = 0; i < _bitCount; ++i) {
+      all = _bits[i]->watch(owner) && all;
+    }
+    return all;
+  }
+
+  virtual byte count() {
+    return _count;
+  }
+
+  virtual byte read() {
+    byte code = 0;
+    for (byte i = 0; i < _bitCount; ++i) {
+      if (!_bits[i]->read()) {
+        code |= 1 << i;
+      }
+    }
+    return _table[code];
+  }
+};
+
+/* A selector that switches between the taps of a resistor ladder on
+   an analog pin. `levels` are what the pin reads at each position, in
+   counts. If the pin reads something else while the knob's between
+   positions - the pull-up, with nothing connected - give that as
+   `open`, so it doesn't get taken for the nearest position. */
+class LadderPositions : public Positions {
+ private:
+  AnalogInput* _in;
+  Bands* _bands;
+  byte* _positions;
+  byte _count;
+  byte _band;
+
+ public:
+  LadderPositions(AnalogInput* in, const int* levels, byte count,
+                  int open = -1, int hysteresis = 8) {
+    _in = in;
+    _count = count;
+    byte bands = open < 0 ? count : count + 1;
+    int* all = new int[bands];
+    memcpy(all, levels, count * sizeof(int));
+    if (open >= 0) {
+      all[count] = open;
+    }
+    _positions = new byte[bands];
+    _bands = levelBands(all, bands, hysteresis, _positions);
+    delete[] all;
+    if (open >= 0) {
+      _positions[_bands->find(open)] = NoPosition;
+    }
+    _band = NoPosition;
+  }
+
+  virtual void setup() {
+    _in->setup();
+  }
+
+  virtual byte count() {
+    return _count;
+  }
+
+  virtual byte read() {
+    _band = _bands->decode(_in->readCounts(), _band);
+    return _positions[_band];
+  }
+};
+
+/* A rotary selector switch with any number of positions - the HSI mode
+   knob, say - that presses the button for the position it's turned
+   to, and releases the one for where it was. There's one button per
+   position, in `buttons`; MomentaryButtons, usually, so the host sees
+   each change as a single press.
+
+   A position has to read the same `settleReads` updates running before
+   it counts, so contacts wiping across on the way don't fire their
+   buttons, and while the knob's between positions it stays where it
+   was. Watchable if its inputs are. */
+class RotarySelector : public Component {
+ private:
+  Positions* _positions;
+  Button** _buttons;
+  byte _settleReads;
+  byte _last;
+  byte _candidate;
+  byte _seen;
+
+ public:
+  RotarySelector(Positions* positions, Button** buttons, byte settleReads = 2) {
+    _positions = positions;
+    _buttons = buttons;
+    _settleReads = settleReads;
+    _last = NoPosition;
+    _candidate = NoPosition;
+    _seen = 0;
+  }
+
+  virtual void setup() {
+    _positions->setup();
+  }
+
+  virtual bool watch(byte id) {
+    return _positions->watch(id);
+  }
+
+  virtual bool busy() {
+    if (_candidate != NoPosition) {
+      return true;
+    }
+    for (byte i = 0; i < _positions->count(); ++i) {
+      if (_buttons[i]->busy()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  byte position() {
+    return _last;
+  }
+
+  virtual void snapshot() {
+    _last = _positions->read();
+  }
+
+  virtual void update() {
+    for (byte i = 0; i < _positions->count(); ++i) {
+      _buttons[i]->update();
+    }
+
+    byte current = _positions->read();
+    if (current == NoPosition || current == _last) {
+      _candidate = NoPosition;
+      return;
+    }
+    if (current != _candidate) {
+      _candidate = current;
+      _seen = 0;
+    }
+    if (++_seen < _settleReads) {
+      return;
+    }
+
+    if (_last != NoPosition) {
+      _buttons[_last]->release();
+    }
+    _buttons[current]->press();
+    _last = current;
+    _candidate = NoPosition;
+  }
+
+  virtual void resync(PressQueue* queue) {
+    if (_last != NoPosition) {
+      queue->enqueue(_buttons[_last]);
+    }
+  }
+};
+
+void Sampler::sample() {
+  Snapshot* snapshot = &_snapshots[1 - _held];
+  _sampling = true;
+  for (byte i = 0; i < _portCount; ++i) {
+    snapshot->ports[i] = halReadPort(_ports[i]);
+  }
+  for (byte i = 0; i < _muxCount; ++i) {
+    snapshot->muxes[i] = _muxes[i]->sample();
+  }
+  if (_analogCount) {
+    sampleAnalogs();
+    memcpy(snapshot->analogs, _analogs, sizeof(_analogs));
+  }
+  snapshot->time = microClock.us();
+  _sampling = false;
+  _latest = 1 - _held;
+}
 #endif
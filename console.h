@@ -0,0 +1,142 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include "events.h"
+
+/* The serial console: single-character commands in, text out, without
+   ever making the loop wait on the host. Printing straight to Serial
+   stalls whenever the host isn't reading, so nothing here does.
+
+   Going out, the console is a Print that writes into a ring buffer,
+   and poll() hands the port as much of it as the port will take. If
+   the buffer's full, the rest of what's printed is dropped and
+   counted.
+
+   Coming in, poll() reads a few bytes at most, and only once the
+   buffer's empty, so a command always has the whole buffer for its
+   answer. Commands with more to say than that - a line per button, a
+   line per component - say it a line at a time: the handler gets
+   called again with the next row for as long as it returns true, as
+   often as there's room for a row. Anything the host sends while
+   that's going on waits in the port.
+
+   poll() runs between scans, and when there's nothing to do it costs
+   a look at the port and not much else. The event stream goes down
+   the same port from its own buffer, so with both going, a record can
+   end up with some text in the middle of it; the checksum's there for
+   that. */
+
+/* Called with the command character and the row, from 0. Prints the
+   row to `out`, and returns true if there may be another one. Asked
+   for a row past the end, it prints nothing and returns false. */
+typedef bool (*ConsoleHandler)(int c, byte row, Print* out);
+
+/* Room a row needs in the buffer before it gets printed. A row that's
+   longer than this can lose its end. */
+const byte ConsoleRowBytes = 80;
+
+class Console : public Print {
+ private:
+  Stream* _port;
+  TxRing _ring;
+  ConsoleHandler _handler;
+  int _command;
+  byte _row;
+  unsigned long _dropped;
+
+ public:
+  Console(Stream* port, ConsoleHandler handler, unsigned int capacity = 192)
+    : _ring(capacity) {
+    _port = port;
+    _handler = handler;
+    _command = -1;
+    _row = 0;
+    _dropped = 0;
+  }
+
+  virtual size_t write(uint8_t b) {
+    if (!_ring.put(&b, 1)) {
+      ++_dropped;
+      return 0;
+    }
+    return 1;
+  }
+
+  virtual int availableForWrite() {
+    return _ring.room();
+  }
+
+  /* Reads up to `bytes` command characters, or prints up to `rows`
+     rows of the command that's running, then sends what it can. */
+  void poll(byte bytes = 4, byte rows = 4) {
+    if (_command >= 0) {
+      while (rows-- > 0 && _ring.room() >= ConsoleRowBytes) {
+        if (!_handler(_command, ++_row, this)) {
+          _command = -1;
+          break;
+        }
+      }
+    }
+    else {
+      while (bytes-- > 0 && _ring.empty() && _port->available() > 0) {
+        int c = _port->read();
+        if (_handler(c, 0, this)) {
+          _command = c;
+          _row = 0;
+          break;
+        }
+      }
+    }
+    _ring.drain(_port);
+  }
+
+  /* True if poll() has something to do that the port's ready for, so
+     the loop shouldn't go to sleep on it. */
+  bool due() {
+    if (_command >= 0) {
+      return _ring.room() >= ConsoleRowBytes;
+    }
+    return !_ring.empty() && _port->availableForWrite() > 0;
+  }
+
+  unsigned long dropped() {
+    return _dropped;
+  }
+};
+
+/* How long the scans are taking, for the console. */
+class ScanStats {
+ private:
+  unsigned long _scans;
+  unsigned long _totalUs;
+  unsigned long _lastUs;
+  unsigned long _worstUs;
+
+ public:
+  ScanStats() {
+    _scans = 0;
+    _totalUs = 0;
+    _lastUs = 0;
+    _worstUs = 0;
+  }
+
+  void scanned(unsigned long us) {
+    ++_scans;
+    _totalUs += us;
+    _lastUs = us;
+    _worstUs = max(_worstUs, us);
+  }
+
+  void status(Print* out) {
+    out->print(_scans);
+    out->print(F(" scans, last "));
+    out->print(_lastUs);
+    out->print(F("us, average "));
+    out->print(_scans ? _totalUs / _scans : 0);
+    out->print(F("us, worst "));
+    out->print(_worstUs);
+    out->println(F("us"));
+  }
+};
+
+#endif
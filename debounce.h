@@ -0,0 +1,202 @@
+#ifndef _DEBOUNCE_H
+#define _DEBOUNCE_H
+
+/* Switch contacts bounce when they close, and how long for depends on
+   the switch: a cheap toggle can rattle for ten milliseconds where a
+   good pushbutton is done in one. Pick one debounce window for all of
+   them and it's either too long for the good ones or too short for
+   the bad ones. So each DebouncedInput works out its own.
+
+   A change only counts once the input has held still for its window.
+   Meanwhile it watches how the contacts actually behave: the longest
+   gap between two edges of the same bounce is what the window has to
+   outlast, so the window is kept at twice the longest gap seen
+   lately, within `minMs` and `maxMs`. A bigger gap than usual widens
+   the window straight away; smaller ones narrow it a little at a
+   time. A change that comes back within `maxMs` of the last one
+   settling means the window was too short to see the whole bounce,
+   and counts as a gap too.
+
+   Bounces only show up if the input gets read while they're
+   happening, which is what watched pins are for: every edge gets its
+   component updated within a couple of milliseconds. Inputs that are
+   only read every scan see no bounce, and keep the shortest window,
+   which is fine - the scan period is a debounce in itself.
+
+   Send 'w' over the serial port for what each input has learned. */
+
+class DebouncedInput;
+
+/* Every debounced input, for the status report. */
+class Debounce {
+ private:
+  DebouncedInput* _head;
+  byte _count;
+
+ public:
+  Debounce() {
+    _head = 0;
+    _count = 0;
+  }
+
+  /* Returns the number the input goes by in status reports. */
+  byte add(DebouncedInput* input);
+
+  /* Prints the line for input `n`, one at a time so a long list
+     doesn't have to fit in the console's buffer all at once. False
+     past the last input. */
+  bool status(byte n, Print* out);
+};
+
+Debounce debounce;
+
+class DebouncedInput : public DigitalInput, public Timer {
+  friend class Debounce;
+
+ private:
+  DigitalInput* _in;
+  DebouncedInput* _next;
+  byte _number;
+  byte _owner;
+  unsigned long _minUs;
+  unsigned long _maxUs;
+  bool _stable;
+  bool _raw;
+  bool _settling;
+  unsigned long _burstStart;
+  unsigned long _lastEdge;
+  // All in microseconds.
+  unsigned int _burstGap;
+  unsigned int _gap;
+  unsigned long _window;
+  unsigned int _lastBounce;
+  unsigned int _bursts;
+
+  void learn() {
+    _lastBounce = min(_lastEdge - _burstStart, 65535UL);
+    ++_bursts;
+    if (_burstGap > _gap) {
+      widen(_burstGap);
+    }
+    else {
+      _gap -= (_gap - _burstGap) / 8;
+      _window = constrain(2UL * _gap, _minUs, _maxUs);
+    }
+  }
+
+  void widen(unsigned int gap) {
+    _gap = gap;
+    _window = constrain(2UL * _gap, _minUs, _maxUs);
+  }
+
+ public:
+  DebouncedInput(DigitalInput* in, unsigned int minMs = 1, unsigned int maxMs = 20) {
+    _in = in;
+    _next = 0;
+    _owner = NoComponent;
+    _minUs = minMs * 1000UL;
+    _maxUs = maxMs * 1000UL;
+    _stable = false;
+    _raw = false;
+    _settling = false;
+    _burstStart = 0;
+    _lastEdge = 0;
+    _burstGap = 0;
+    _gap = 0;
+    _window = _minUs;
+    _lastBounce = 0;
+    _bursts = 0;
+    _number = debounce.add(this);
+  }
+
+  virtual void setup() {
+    _in->setup();
+    _raw = _in->read();
+    _stable = _raw;
+  }
+
+  virtual bool watch(byte owner) {
+    if (!_in->watch(owner)) {
+      return false;
+    }
+    _owner = owner;
+    return true;
+  }
+
+  virtual bool read() {
+    bool raw = _in->read();
+    unsigned long now = microClock.us();
+
+    if (raw != _raw) {
+      _raw = raw;
+      if (_settling) {
+        _burstGap = max(_burstGap, (unsigned int)min(now - _lastEdge, 65535UL));
+      }
+      else {
+        _settling = true;
+        _burstStart = now;
+        _burstGap = 0;
+        if (_bursts > 0 && now - _lastEdge < _maxUs) {
+          // Nobody flips a switch back this fast: the last change
+          // settled too soon, and this is more of its bounce.
+          _burstGap = min(now - _lastEdge, 65535UL);
+          if (_burstGap > _gap) {
+            widen(_burstGap);
+          }
+        }
+      }
+      _lastEdge = now;
+      if (_owner != NoComponent) {
+        // Nothing else is going to read us again if the contacts stop
+        // moving, so come back when the window's up.
+        timers.schedule(this, (_window + 999) / 1000);
+      }
+    }
+
+    if (_settling && now - _lastEdge >= _window) {
+      _settling = false;
+      _stable = _raw;
+      learn();
+    }
+    return _stable;
+  }
+
+  virtual void expire() {
+    pinWatch.poke(_owner);
+  }
+};
+
+byte Debounce::add(DebouncedInput* input) {
+  input->_next = _head;
+  _head = input;
+  return _count++;
+}
+
+bool Debounce::status(byte n, Print* out) {
+  DebouncedInput* input = _head;
+  while (input && input->_number != n) {
+    input = input->_next;
+  }
+  if (!input) {
+    return false;
+  }
+  out->print(F("input "));
+  out->print(input->_number);
+  out->print(F(": window "));
+  out->print(input->_window);
+  out->print(F("us, longest gap "));
+  out->print(input->_gap);
+  out->print(F("us, last bounce "));
+  out->print(input->_lastBounce);
+  out->print(F("us, "));
+  out->print(input->_bursts);
+  out->println(F(" changes"));
+  return true;
+}
+
+/* Less typing in the components array. */
+DigitalInput* debounced(DigitalInput* in, unsigned int minMs = 1, unsigned int maxMs = 20) {
+  return new DebouncedInput(in, minMs, maxMs);
+}
+
+#endif
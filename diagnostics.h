@@ -0,0 +1,240 @@
+#ifndef _DIAGNOSTICS_H
+#define _DIAGNOSTICS_H
+
+/* Wiring goes wrong in two ways that matter to us. A wire comes off
+   and the input floats, and a floating input chatters away and fills
+   the report with nonsense. Or a wire comes off somewhere that leaves
+   the input pulled up - like the data line of a 74LS151, which takes
+   all eight of its switches with it - and the switch just looks like
+   it's never moved.
+
+   A MonitoredInput sits in front of a DigitalInput and keeps a couple
+   of counters: how many times it's changed in the current window, and
+   how many windows it's gone without changing at all. An input that
+   changes more often than any hand could flip it is quarantined: it
+   holds the value it had before the trouble started, so it stops
+   producing reports, until it's been still for a while.
+
+   Not moving for a long time is only a fault for some inputs: a
+   toggle can sit where it is all evening, but a switch that gets
+   flipped every sortie shouldn't. So each input gets its own
+   `stuckMinutes`, and one that hasn't changed in that long is
+   flagged, in case it's stuck. The default, 0, never flags it. Send
+   'h' over the serial port to hear about both. */
+
+class MonitoredInput;
+
+/* Every monitored input, and the timer that closes each window. */
+class Diagnostics : public Timer {
+ private:
+  MonitoredInput* _head;
+  byte _count;
+  unsigned long _windowMs;
+  ScanGuard* _guard;
+
+ public:
+  /* More changes than this in one window is chattering. */
+  byte chatterLimit;
+  /* Windows without a change before a quarantined input is let go. */
+  byte calmWindows;
+
+  Diagnostics(unsigned long windowMs = 2000) {
+    _head = 0;
+    _count = 0;
+    _windowMs = windowMs;
+    _guard = 0;
+    chatterLimit = 6;
+    calmWindows = 30;
+  }
+
+  /* Returns the number the input goes by in status reports. */
+  byte add(MonitoredInput* input);
+
+  /* While `guard` is shedding load, closing a window waits a tick,
+     which makes that window a little longer. */
+  void start(ScanGuard* guard = 0) {
+    _guard = guard;
+    timers.schedule(this, _windowMs);
+  }
+
+  virtual void expire();
+
+  unsigned long windowMs() {
+    return _windowMs;
+  }
+
+  /* How many inputs are quarantined or look stuck. */
+  byte faults();
+
+  /* Prints the line for the `row`th input that's quarantined or
+     looks stuck, one at a time like Debounce::status(), and a summary
+     after the last of them. False once the summary's printed. */
+  bool status(byte row, Print* out);
+};
+
+Diagnostics diagnostics;
+
+class MonitoredInput : public DigitalInput {
+  friend class Diagnostics;
+
+ private:
+  DigitalInput* _in;
+  MonitoredInput* _next;
+  byte _number;
+  byte _component;
+  bool _value;
+  bool _held;
+  bool _quarantined;
+  byte _toggles;
+  byte _calm;
+  unsigned int _quiet;
+  unsigned int _stuckMinutes;
+
+  void closeWindow() {
+    if (_toggles == 0) {
+      if (_quiet < 0xFFFF) {
+        ++_quiet;
+      }
+      if (_quarantined && ++_calm >= diagnostics.calmWindows) {
+        _quarantined = false;
+      }
+    }
+    else {
+      _quiet = 0;
+      _calm = 0;
+    }
+    _toggles = 0;
+    if (!_quarantined) {
+      _held = _value;
+    }
+  }
+
+  bool stuck() {
+    return _stuckMinutes &&
+      (unsigned long)_quiet * diagnostics.windowMs() >= _stuckMinutes * 60000UL;
+  }
+
+ public:
+  MonitoredInput(DigitalInput* in, unsigned int stuckMinutes = 0) {
+    _in = in;
+    _next = 0;
+    _component = NoComponent;
+    _value = false;
+    _held = false;
+    _quarantined = false;
+    _toggles = 0;
+    _calm = 0;
+    _quiet = 0;
+    _stuckMinutes = stuckMinutes;
+    _number = diagnostics.add(this);
+  }
+
+  virtual void setup() {
+    _in->setup();
+    _value = _in->read();
+    _held = _value;
+  }
+
+  virtual bool read() {
+    if (scanningComponent != NoComponent) {
+      _component = scanningComponent;
+    }
+    bool value = _in->read();
+    if (value != _value) {
+      _value = value;
+      // Not once it's quarantined, or the chatter would push
+      // everything else out of the flight recorder.
+      if (!_quarantined) {
+        recorder.log(RecordInput, _number, value);
+      }
+      if (_toggles < 0xFF) {
+        ++_toggles;
+      }
+      if (_toggles > diagnostics.chatterLimit) {
+        _quarantined = true;
+        _calm = 0;
+      }
+    }
+    return _quarantined ? _held : _value;
+  }
+
+  virtual bool watch(byte owner) {
+    return _in->watch(owner);
+  }
+
+  bool quarantined() {
+    return _quarantined;
+  }
+};
+
+byte Diagnostics::add(MonitoredInput* input) {
+  input->_next = _head;
+  _head = input;
+  return _count++;
+}
+
+void Diagnostics::expire() {
+  if (_guard && _guard->shedding()) {
+    _guard->skipped();
+    timers.schedule(this, TickMs);
+    return;
+  }
+  for (MonitoredInput* input = _head; input; input = input->_next) {
+    input->closeWindow();
+  }
+  timers.schedule(this, _windowMs);
+}
+
+byte Diagnostics::faults() {
+  byte faults = 0;
+  for (MonitoredInput* input = _head; input; input = input->_next) {
+    if (input->_quarantined || input->stuck()) {
+      ++faults;
+    }
+  }
+  return faults;
+}
+
+bool Diagnostics::status(byte row, Print* out) {
+  byte n = 0;
+  for (MonitoredInput* input = _head; input; input = input->_next) {
+    if (!input->_quarantined && !input->stuck()) {
+      continue;
+    }
+    if (n++ != row) {
+      continue;
+    }
+    out->print(F("input "));
+    out->print(input->_number);
+    if (input->_component != NoComponent) {
+      out->print(F(" (component "));
+      out->print(input->_component);
+      out->print(F(")"));
+    }
+    if (input->_quarantined) {
+      out->print(F(": chattering, quarantined"));
+    }
+    else {
+      out->print(F(": no change in "));
+      out->print(input->_quiet * _windowMs / 60000);
+      out->print(F(" min, reads "));
+      out->print(input->_value ? F("high") : F("low"));
+    }
+    out->println();
+    return true;
+  }
+  if (row == n) {
+    out->print(_count);
+    out->print(F(" inputs monitored, "));
+    out->print(n);
+    out->println(F(" faulty"));
+  }
+  return false;
+}
+
+/* Less typing in the components array. */
+DigitalInput* monitored(DigitalInput* in, unsigned int stuckMinutes = 0) {
+  return new MonitoredInput(in, stuckMinutes);
+}
+
+#endif
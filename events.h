@@ -0,0 +1,191 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include <stdint.h>
+
+/* The serial event stream: every button and axis change as a
+   fixed-size binary record, for hosts that would rather not go through
+   the Gamepad at all (see host/falconpaneld.cpp). This part of the
+   file has no Arduino in it, so the host side can include it too.
+
+   A record is twelve bytes, little-endian:
+
+     0     EventSync, so a reader can find the start of a record
+     1     EventButton or EventAxis
+     2     which component made the change - its index in the
+           components array, or EventNoComponent if it happened
+           outside the scan, like a timer going off
+     3     the button number (from 1) or the axis (an AxisId)
+     4-5   the value: 0 or 1 for a button, the report value for an
+           axis, signed
+     6-9   microClock.us() when the change happened
+     10    a sequence number, one more than the last record's; a
+           gap means records were dropped
+     11    the xor of bytes 1 through 10
+
+   A reader that loses its place looks for the next EventSync whose
+   checksum works out. */
+
+const uint8_t EventSync = 0xFA;
+const uint8_t EventButton = 0;
+const uint8_t EventAxis = 1;
+const uint8_t EventNoComponent = 0xFF;
+const uint8_t EventRecordSize = 12;
+
+struct Event {
+  uint8_t kind;
+  uint8_t component;
+  uint8_t index;
+  int16_t value;
+  uint32_t time;
+  uint8_t sequence;
+};
+
+void encodeEvent(const Event* event, uint8_t* buf) {
+  buf[0] = EventSync;
+  buf[1] = event->kind;
+  buf[2] = event->component;
+  buf[3] = event->index;
+  buf[4] = uint16_t(event->value) & 0xFF;
+  buf[5] = uint16_t(event->value) >> 8;
+  for (uint8_t i = 0; i < 4; ++i) {
+    buf[6 + i] = (event->time >> (8 * i)) & 0xFF;
+  }
+  buf[10] = event->sequence;
+  uint8_t check = 0;
+  for (uint8_t i = 1; i < EventRecordSize - 1; ++i) {
+    check ^= buf[i];
+  }
+  buf[EventRecordSize - 1] = check;
+}
+
+/* False if `buf` doesn't hold a good record. */
+bool decodeEvent(const uint8_t* buf, Event* event) {
+  if (buf[0] != EventSync) {
+    return false;
+  }
+  uint8_t check = 0;
+  for (uint8_t i = 1; i < EventRecordSize - 1; ++i) {
+    check ^= buf[i];
+  }
+  if (check != buf[EventRecordSize - 1]) {
+    return false;
+  }
+  event->kind = buf[1];
+  event->component = buf[2];
+  event->index = buf[3];
+  event->value = int16_t(buf[4] | (uint16_t(buf[5]) << 8));
+  event->time = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    event->time |= uint32_t(buf[6 + i]) << (8 * i);
+  }
+  event->sequence = buf[10];
+  return true;
+}
+
+#ifdef ARDUINO
+
+/* Bytes on their way out of a serial port. Anything that wants to
+   talk to the host puts what it has to say in here, all or nothing,
+   and drain() hands over as much as the port will take without
+   blocking. */
+class TxRing {
+ private:
+  byte* _buf;
+  unsigned int _capacity;
+  unsigned int _head;
+  unsigned int _size;
+
+ public:
+  TxRing(unsigned int capacity) {
+    _buf = new byte[capacity];
+    _capacity = capacity;
+    _head = 0;
+    _size = 0;
+  }
+
+  unsigned int room() {
+    return _capacity - _size;
+  }
+
+  bool empty() {
+    return _size == 0;
+  }
+
+  /* False, with nothing queued, if there isn't room for all of it. */
+  bool put(const byte* data, unsigned int len) {
+    if (len > room()) {
+      return false;
+    }
+    for (unsigned int i = 0; i < len; ++i) {
+      _buf[(_head + _size + i) % _capacity] = data[i];
+    }
+    _size += len;
+    return true;
+  }
+
+  void drain(Print* port) {
+    int room = port->availableForWrite();
+    while (room > 0 && _size > 0) {
+      // Write the contiguous run up to the end of the buffer, or as
+      // much of it as fits.
+      unsigned int run = min(min(_size, _capacity - _head), (unsigned int)room);
+      port->write(_buf + _head, run);
+      _head = (_head + run) % _capacity;
+      _size -= run;
+      room -= run;
+    }
+  }
+};
+
+/* Sends every button and axis change down a serial port as an event
+   record. Records go through a ring buffer that's drained a bit at a
+   time by flush(), so a host that isn't keeping up never holds up the
+   scan. When the buffer's full, records are dropped and counted. */
+class EventStream : public ReportListener {
+ private:
+  Print* _port;
+  TxRing _ring;
+  byte _sequence;
+  unsigned long _dropped;
+
+  void send(uint8_t kind, const OutputEvent* output) {
+    Event event;
+    event.kind = kind;
+    // NoComponent and EventNoComponent are both 0xFF.
+    event.component = output->component;
+    event.index = output->index;
+    event.value = output->value;
+    event.time = output->time;
+    event.sequence = _sequence++;
+    uint8_t buf[EventRecordSize];
+    encodeEvent(&event, buf);
+    if (!_ring.put(buf, EventRecordSize)) {
+      ++_dropped;
+    }
+  }
+
+ public:
+  EventStream(Print* port, unsigned int capacity = 16 * EventRecordSize)
+    : _ring(capacity) {
+    _port = port;
+    _sequence = 0;
+    _dropped = 0;
+  }
+
+  virtual void changed(const OutputEvent* event) {
+    send(event->kind == OutputButton ? EventButton : EventAxis, event);
+  }
+
+  void flush() {
+    _ring.drain(_port);
+  }
+
+  unsigned long dropped() {
+    return _dropped;
+  }
+};
+
+#endif
+
+#endif
@@ -4,128 +4,512 @@
   Falconpanel - a set of functions for turning an Arduino into a
   DirectX game controller.
 
-  Modify the components array below to match your setup.
+  Modify the components array in panel.h to match your setup.
 
 */
 
 const int pinLed = LED_BUILTIN;
 
+// Uncomment to make this board a satellite, which sends its buttons
+// and axes to a master board instead of the host.
+// #define FALCONPANEL_SATELLITE
+
+// Uncomment to time the scan at startup, over the serial port, so it
+// can be compared with another board's. See bench.h.
+// #define FALCONPANEL_BENCH
+
 #include "components.h"
+#include "satellite.h"
+#include "events.h"
+#include "calibration.h"
+#include "scanguard.h"
+#include "diagnostics.h"
+#include "debounce.h"
+#include "power.h"
+#include "console.h"
+#include "panel.h"
+#ifdef FALCONPANEL_BENCH
+#include "bench.h"
+#endif
+
+#ifdef FALCONPANEL_SATELLITE
+// How this board talks to the master: Serial1, on pins 0 and 1,
+// crossed over to the master's. I2C would do too, with
+// new I2cUplink(address), but on a Leonardo that's pins 2 and 3, and
+// the mux in panel.h has those.
+Uplink* uplink = new UartUplink(&Serial1);
+#else
+// Satellite boards feeding this one, if there are any. Add them in
+// setup().
+SatelliteHub satellites(4);
+#endif
+
+// How often we scan the components, in milliseconds. This also serves
+// as a simple debounce.
+const unsigned long scanPeriod = 75;
+unsigned long nextScan = 0;
+
+// The inputs are sampled this many times a second from a timer
+// interrupt, and the components work from the latest sample rather
+// than reading the pins themselves.
+const unsigned int sampleRate = 500;
+
+// Components whose inputs can all interrupt - switches on pins 7-11,
+// say - are only updated when one of those inputs changes, straight
+// away rather than at the next scan. One bit per component. Everything
+// gets a look every sweepPeriod anyway, in case an edge went missing,
+// and edges get handled at most every settlePeriod. That's short, so
+// debounced() gets to see the contacts bounce; it does the settling.
+unsigned long eventDriven = 0;
+const unsigned long sweepPeriod = 1000;
+const unsigned long settlePeriod = 2;
+unsigned long nextSweep = 0;
+unsigned long nextEdgeScan = 0;
+
+// The components that can sit out a few scans when scanGuard is
+// shedding load, one bit per component.
+unsigned long shedMask = 0;
+
+// After ten seconds without a change, the board sleeps between scans
+// and scans half as often. Watched switches still get handled straight
+// away; the rest can take up to idleScanPeriod to be noticed.
+Power power(10000);
+const unsigned long idleScanPeriod = 150;
+
+// A scan should take well under 2ms. One that takes longer makes the
+// pots (anything whose sheddable() says so) and the diagnostics sit
+// out the next 8 scans, and if a pass through the loop ever takes
+// half a second, the watchdog resets the board. Send 'm' to see how
+// often that's happened.
+ScanGuard scanGuard(2000, 8, 500);
+
+// When the panel is resynced, every latching switch presses the
+// button for its current position again, one at a time through this
+// queue. At 25ms down and 25ms up, a dozen switches take 600ms.
+PressQueue syncQueue(32, 25, 25);
 
-// I've got a 74LS151 3-to-8 mux with its address pins connected to
-// Arduino pins 2-4, and with its output pin connected to Arduino pin
-// 5. We have to declare this outside the components array below
-// because we reference it in there.
-IC74LS151* mux1 = new IC74LS151(new DigitalOutputPin(2),
-                                new DigitalOutputPin(3),
-                                new DigitalOutputPin(4),
-                                new DigitalInputPullupPin(5));
-
-// Keep track of the button number so I don't have to keep looking at
-// what I used.
-int dxButton = 1;
-
-// Configure our particular setup. Change this to match what you have.
-Component* components[] =   {
-  // List the mux here so its setup gets called
-  mux1,
-  // Master Arm
-  new OnOffOnSwitch(mux1->input(0),
-                    mux1->input(1),
-                    new MomentaryButton(new DxButton(dxButton++)),
-                    new MomentaryButton(new DxButton(dxButton++)),
-                    new MomentaryButton(new DxButton(dxButton++))),
-  // Laser Arm
-  new OnOffSwitch(mux1->input(2),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Emergency Stores Jettison
-  new PushButton(mux1->input(3), new DxButton(dxButton++)),
-  // Parking Brake
-  new OnOffSwitch(new DigitalInputPullupPin(6),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Stores config
-  new OnOffSwitch(new DigitalInputPullupPin(7),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Taxi Lights
-  new OnOffSwitch(mux1->input(4),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Landing Gear
-  new OnOffSwitch(mux1->input(5),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // HMCS
-  new SwitchingRotary(new AnalogInputPin(0),
-                      DxAxis::XRotation(),
-                      new MomentaryButton(new DxButton(dxButton++)),
-                      new MomentaryButton(new DxButton(dxButton++)),
-                      0.05),
-  // Chaff
-  new OnOffSwitch(new DigitalInputPullupPin(8),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Flares
-  new OnOffSwitch(new DigitalInputPullupPin(9),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Altimeter
-  new PulseRotary(new AnalogInputPin(1),
-                  new MomentaryButton(new DxButton(dxButton++), 1),
-                  new MomentaryButton(new DxButton(dxButton++), 1),
-                  16),
-  // A/R Door
-  new OnOffSwitch(new DigitalInputPullupPin(10),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // Master Lights
-  new OnOffSwitch(new DigitalInputPullupPin(11),
-                  new MomentaryButton(new DxButton(dxButton++)),
-                  new MomentaryButton(new DxButton(dxButton++))),
-  // AVCD
-  new OnOffOnSwitch(mux1->input(6),
-                    mux1->input(7),
-                    new MomentaryButton(new DxButton(dxButton++)),
-                    new MomentaryButton(new DxButton(dxButton++)),
-                    new MomentaryButton(new DxButton(dxButton++))),
-                    
-  // Altimeter adjustment
-  new RotaryEncoder(new DigitalInputPullupPin(12),
-                    new DigitalInputPullupPin(13),
-                    new DxButton(dxButton++),
-                    new DxButton(dxButton++),
-                    4)
+void syncPanel() {
+  for (int i = 0; i < componentCount; ++i) {
+    components[i]->resync(&syncQueue);
+  }
+}
+
+// What the host hears about the switches when we start up:
+//   BootBurst  - every switch presses its button on the first scan,
+//                all at once. The sim tends to drop some of them.
+//   BootSilent - nothing; resync by hand once the sim is ready.
+//   BootReplay - the positions are played back through syncQueue.
+enum BootMode : byte {
+  BootBurst, BootSilent, BootReplay
+};
+
+const BootMode bootMode = BootReplay;
+
+// How long startup took, in microseconds from when the sketch started
+// to the end of each phase, or 0 if it hasn't ended yet. Send 'b' to
+// see them.
+struct BootTimes {
+  // Every component set up and its pins configured.
+  unsigned long pins;
+  // The host has finished enumerating us, and reports will get there.
+  unsigned long usb;
+  unsigned long firstScan;
+  unsigned long firstReport;
+  // The host has heard where every switch is.
+  unsigned long inSync;
 };
 
-const int componentCount = sizeof(components)/sizeof(Component*);
+BootTimes bootTimes;
+
+// With BootReplay, the replay waits for the host to enumerate us, or
+// it'd play to nobody.
+bool bootReplayPending = false;
+
+// Every button and axis change can also go down the serial port as a
+// binary record, for falconpaneld on a Linux host. It starts out off;
+// falconpaneld turns it on with an 'e'.
+EventStream eventStream(&Serial);
+
+// Commands come in over the serial port, and what they have to say
+// goes back out through the console's buffer, so a host that isn't
+// listening never holds up the loop. See command() below.
+bool command(int c, byte row, Print* out);
+Console console(&Serial, command);
+
+ScanStats scanStats;
+
+// The inputs as the scan saw them, copied when 'i' starts so every
+// line comes from the same moment.
+Snapshot inputDump;
+
+// Prints the bits of `b`, highest first.
+void printBits(byte b, Print* out) {
+  for (int i = 7; i >= 0; --i) {
+    out->print(bitRead(b, i) ? '1' : '0');
+  }
+}
+
+// Row `row` of the 'i' dump: the time, then every sampled port, mux
+// and analog pin.
+bool dumpInputs(byte row, Print* out) {
+  if (!sampler.active()) {
+    out->println(F("not sampling; inputs are read when they're scanned"));
+    return false;
+  }
+  if (row == 0) {
+    inputDump = *sampler.held();
+    out->print(F("inputs at "));
+    out->print(inputDump.time);
+    out->print(F("us"));
+    if (sampler.analogsRefused()) {
+      out->print(F(", "));
+      out->print(sampler.analogsRefused());
+      out->print(F(" analog inputs turned away"));
+    }
+    out->println();
+    return true;
+  }
+  byte n = row - 1;
+  if (n < sampler.portCount()) {
+    out->print(F("port "));
+    out->print(n);
+    out->print(F(": "));
+    printBits(inputDump.ports[n], out);
+    out->println();
+    return true;
+  }
+  n -= sampler.portCount();
+  if (n < sampler.muxCount()) {
+    out->print(F("mux "));
+    out->print(n);
+    out->print(F(": "));
+    printBits(inputDump.muxes[n], out);
+    out->println();
+    return true;
+  }
+  n -= sampler.muxCount();
+  if (n < sampler.analogCount()) {
+    out->print(F("analog "));
+    out->print(n);
+    out->print(F(": "));
+    out->println(inputDump.analogs[n]);
+    return true;
+  }
+  return false;
+}
+
+// Row `row` of the 'k' dump: one component, how it gets scanned, the
+// buttons it's been seen to move, and whatever else it has to say.
+bool dumpComponent(byte row, Print* out) {
+  if (row >= componentCount) {
+    return false;
+  }
+  out->print(F("component "));
+  out->print(row);
+  out->print(row < 32 && bitRead(eventDriven, row) ? F(": watched") : F(": scanned"));
+  out->print(components[row]->busy() ? F(", busy") : F(", idle"));
+  out->print(F(", buttons"));
+  for (byte num = 1; num <= 32; ++num) {
+    if (outputs.owner(num) == row) {
+      out->print(' ');
+      out->print(num);
+    }
+  }
+  components[row]->status(out);
+  out->println();
+  return true;
+}
+
+// Row `row` of the 'n' dump: a button, whether it's down, and which
+// component last moved it.
+bool dumpButton(byte row, Print* out) {
+  byte num = row + 1;
+  if (num >= dxButton || num > 32) {
+    return false;
+  }
+  out->print(F("button "));
+  out->print(num);
+  out->print(bitRead(panelReport.buttons(), num - 1) ? F(": down") : F(": up"));
+  byte owner = outputs.owner(num);
+  if (owner != NoComponent) {
+    out->print(F(", component "));
+    out->print(owner);
+  }
+  out->println();
+  return true;
+}
+
+// Single-character commands over the serial port, through the
+// console. If you have a spare input, a SyncButton can do the resync
+// instead - list it in the components array and check it in loop()
+// alongside the console. Most commands are done at row 0; the dumps
+// go on a row at a time until they run out.
+bool command(int c, byte row, Print* out) {
+  if (row == 0) {
+    power.activity();
+  }
+  switch (c) {
+  case 's':
+    syncPanel();
+    break;
+  case 'e':
+    reportListener = &eventStream;
+    break;
+  case 'E':
+    reportListener = 0;
+    break;
+  case 'b':
+    out->print(F("boot: pins "));
+    out->print(bootTimes.pins);
+    out->print(F("us, usb "));
+    out->print(bootTimes.usb);
+    out->print(F("us, first scan "));
+    out->print(bootTimes.firstScan);
+    out->println(F("us"));
+    out->print(F("first report "));
+    out->print(bootTimes.firstReport);
+    out->print(F("us, in sync "));
+    out->print(bootTimes.inSync);
+    out->println(F("us"));
+    break;
+  case 'c':
+    if (calibration.running()) {
+      calibration.finish();
+      out->println(F("calibrated"));
+    }
+    else {
+      calibration.start();
+      out->println(F("calibrating: sweep every pot, then send 'c' again"));
+    }
+    break;
+  case 'p':
+    power.status(out);
+    break;
+  case 'q':
+    outputs.status(out);
+    out->print(F("axis reports skipped: "));
+    out->println(axisReportsSkipped);
+    break;
+  case 'h':
+    return diagnostics.status(row, out);
+  case 'w':
+    return debounce.status(row, out);
+  case 'm':
+    scanStats.status(out);
+    scanGuard.status(out);
+    break;
+  case 'i':
+    return dumpInputs(row, out);
+  case 'k':
+    return dumpComponent(row, out);
+  case 'n':
+    return dumpButton(row, out);
+  case 'r':
+    return recorder.status(row, out);
+  case 'd':
+    out->print(F("events dropped: "));
+    out->print(eventStream.dropped());
+    out->print(F(", console bytes dropped: "));
+    out->println(console.dropped());
+    break;
+  }
+  return false;
+}
 
 void setup() {
+  recorder.begin();
   pinMode(pinLed, OUTPUT);
+  Serial.begin(115200);
+
+#ifndef FALCONPANEL_SATELLITE
+  // The host can't see us until it's enumerated the USB device, which
+  // takes a good fraction of a second, so get the Gamepad going first
+  // and set everything else up while the host does that. Nothing gets
+  // sent until halHidReady() says it'll arrive.
+  // Make sure all desired USB functions are activated in USBAPI.h!
+  halHidBegin();
+
+  // For example, one on Serial1 (pins 0 and 1):
+  // satellites.add(new UartSatelliteLink(&Serial1));
+  // I2C takes pins 2 and 3, so the mux would have to move first.
+#endif
 
   for (int i = 0; i < componentCount; ++i) {
     components[i]->setup();
   }
 
-  // Sends a clean report to the host. This is important on any Arduino type.
-  // Make sure all desired USB functions are activated in USBAPI.h!
-  Gamepad.begin();
+  for (int i = 0; i < componentCount && i < 32; ++i) {
+    if (components[i]->watch(i)) {
+      eventDriven |= 1UL << i;
+    }
+    if (components[i]->sheddable()) {
+      shedMask |= 1UL << i;
+    }
+  }
 
+  sampler.start(sampleRate);
+  bootTimes.pins = halMicros();
+
+  diagnostics.start(&scanGuard);
+  power.setup();
+
+  if (bootMode != BootBurst) {
+    for (int i = 0; i < componentCount; ++i) {
+      components[i]->snapshot();
+    }
+  }
+
+#ifdef FALCONPANEL_SATELLITE
+  uplink->setup();
+  if (bootMode == BootReplay) {
+    panelClock.tick();
+    syncPanel();
+  }
+#else
+  bootReplayPending = bootMode == BootReplay;
+#endif
+
+#ifdef FALCONPANEL_BENCH
+  // Once somebody's listening, then it's a panel like any other.
+  while (!Serial) {
+  }
+  benchScans(components, componentCount, 1000, &Serial);
+#endif
+
+  // Last, so nothing above has to worry about it.
+  scanGuard.start();
 }
 
 void loop() {
+  scanGuard.kick();
+  panelClock.tick();
 
-  for (int i = 0; i < componentCount; ++i) {
-    components[i]->update();
+  bool tick = panelClock.reached(nextScan);
+  if (tick || (pinWatch.pending() && panelClock.reached(nextEdgeScan))) {
+    unsigned long scanStart = microClock.us();
+    bool sweep = tick && panelClock.reached(nextSweep);
+    unsigned long edgeAt;
+    unsigned long edges = pinWatch.take(&edgeAt);
+    if (edges) {
+      nextEdgeScan = panelClock.now() + settlePeriod;
+      power.edge(scanStart - edgeAt);
+    }
+    // A pin change is newer than the latest sample, so take another.
+    sampler.acquire(edges != 0);
+    if (tick) {
+      nextScan = panelClock.now() + (power.idle() ? idleScanPeriod : scanPeriod);
+    }
+    if (sweep) {
+      nextSweep = panelClock.now() + sweepPeriod;
+    }
+
+    for (int i = 0; i < componentCount; ++i) {
+      bool due;
+      if (i < 32 && bitRead(eventDriven, i)) {
+        due = bitRead(edges, i) || (tick && (sweep || components[i]->busy()));
+      }
+      else {
+        due = tick;
+      }
+      if (due && i < 32 && bitRead(shedMask, i) && scanGuard.shedding()) {
+        scanGuard.skipped();
+        due = false;
+      }
+      if (due) {
+        scanningComponent = i;
+        components[i]->update();
+      }
+    }
+    scanningComponent = NoComponent;
+
+    unsigned long took = microClock.us() - scanStart;
+    power.scanned(took);
+    scanStats.scanned(took);
+    scanGuard.scanned(took);
+    if (!bootTimes.firstScan) {
+      bootTimes.firstScan = halMicros();
+    }
+  }
+
+  // Anything that's waiting on a time rather than a scan, like a
+  // gesture threshold, gets to go now.
+  timers.run();
+
+  // Everything the scan and the timers changed goes into the report
+  // now, and out to the event stream if it's on.
+  outputs.drain(&panelReport);
+
+#ifdef FALCONPANEL_SATELLITE
+  if (panelReport.dirty()) {
+    power.activity();
+  }
+
+  uplink->send(&panelReport);
+  if (!bootTimes.firstReport) {
+    bootTimes.firstReport = halMicros();
+  }
+#else
+  // A report that's being held until the host is ready isn't anybody
+  // doing anything.
+  bool usbReady = halHidReady();
+  if (usbReady && panelReport.dirty()) {
+    power.activity();
+  }
+  if (usbReady && !bootTimes.usb) {
+    bootTimes.usb = halMicros();
+  }
+  if (usbReady && bootReplayPending) {
+    bootReplayPending = false;
+    panelClock.tick();
+    syncPanel();
   }
 
   // functions before only set the values
-  // this writes the report to the host
-  Gamepad.write();
+  // this writes the report to the host, along with whatever the
+  // satellites have to say, but only if something changed. Until the
+  // host has enumerated us, it waits.
+  if (usbReady && (panelReport.dirty() || satellites.changed())) {
+    Report merged = panelReport;
+    satellites.mergeInto(&merged);
+    merged.send();
+    panelReport.clean();
+    if (!bootTimes.firstReport) {
+      bootTimes.firstReport = halMicros();
+    }
+  }
+#endif
+
+  if (!bootTimes.inSync && bootTimes.firstReport &&
+      !bootReplayPending && !syncQueue.busy()) {
+    bootTimes.inSync = halMicros();
+  }
+
+  eventStream.flush();
 
-  // simple debounce
-  delay(75);
+  // Commands, and whatever they have to say, a little at a time.
+  console.poll();
+
+  // Wait until the next scan or the next timer, whichever is sooner,
+  // unless a watched pin changes first. Asleep, if we're idle.
+  panelClock.tick();
+  unsigned long wait = timers.idleFor(panelClock.until(nextScan));
+  bool settling = pinWatch.pending();
+  if (settling) {
+    wait = min(wait, panelClock.until(nextEdgeScan));
+  }
+  if (outputs.pending() || console.due()) {
+    // Changes held back for the next report go out on the next pass,
+    // and so does the rest of a console dump.
+    wait = 0;
+  }
+#ifndef FALCONPANEL_SATELLITE
+  if (!bootTimes.usb && !power.idle()) {
+    // Starting up: keep an eye out for the host being ready. If it
+    // still isn't by the time we go idle, the next scan will do.
+    wait = min(wait, 1UL);
+  }
+#endif
+  power.wait(wait, settling);
 }
 
 /*
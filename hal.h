@@ -0,0 +1,478 @@
+#ifndef _HAL_H
+#define _HAL_H
+
+/* The little bit of hardware the components need - pins, the ADC, the
+   time, and somewhere to send the report - behind a few functions, so
+   the same components can run on more than one board. There are three
+   ways to build:
+
+   - On a Leonardo, or any other AVR board, it's the Arduino core and
+     the NicoHood Gamepad. FALCONPANEL_AVR gets defined, which turns on
+     the extras that poke AVR registers directly - a timer interrupt,
+     reading the ADC in the background, reading a whole port at once
+     and pin-change interrupts - so the sampler can run and more pins
+     can be watched.
+
+   - On any other Arduino board - a Cortex-M one, say - it's the
+     Arduino core and a Gamepad with the same methods as NicoHood's.
+     The AVR extras are off, so inputs are read when they're scanned,
+     and only pins with an external interrupt can be watched. There's
+     plenty of CPU to make up for it.
+
+   - On a PC, with FALCONPANEL_HOST defined, there's no hardware at
+     all. hostBoard stands in for the pins, the ADC and the Gamepad, so
+     a program can set inputs, run the components and look at what
+     they'd have sent. This part also fills in the bits of the Arduino
+     core the components use.
+
+   halMicros() is the real time, for measuring how long things take.
+   The panel's own idea of the time is microClock, which on a PC only
+   moves when it's told to. */
+
+#ifdef FALCONPANEL_HOST
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline void noInterrupts() { }
+inline void interrupts() { }
+
+/* On an AVR, F() leaves a string in flash instead of copying it into
+   RAM at startup. Here it's all memory, so it's only a cast. */
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+/* Enough of Arduino's Print for status reports, to stdout. */
+class Print {
+ public:
+  void print(const char* s) { fputs(s, stdout); }
+  void print(const __FlashStringHelper* s) { print(reinterpret_cast<const char*>(s)); }
+  void print(char c) { putchar(c); }
+  void print(int n) { printf("%d", n); }
+  void print(unsigned int n) { printf("%u", n); }
+  void print(long n) { printf("%ld", n); }
+  void print(unsigned long n) { printf("%lu", n); }
+  void print(double n) { printf("%.2f", n); }
+  void println() { putchar('\n'); }
+  template<class T> void println(T value) {
+    print(value);
+    println();
+  }
+};
+
+const byte HostPins = 32;
+
+struct HostBoard {
+  // Digital pins read high, like they're pulled up, until set.
+  bool pins[HostPins];
+  int analogs[HostPins];
+  unsigned long buttons;
+  int axes[6];
+  unsigned long reports;
+
+  HostBoard() {
+    for (byte i = 0; i < HostPins; ++i) {
+      pins[i] = HIGH;
+      analogs[i] = 0;
+    }
+    buttons = 0;
+    memset(axes, 0, sizeof(axes));
+    reports = 0;
+  }
+};
+
+HostBoard hostBoard;
+
+/* Enough of Arduino's EEPROM for calibration.h: blank, the way it
+   comes from the factory, and gone when the program exits. */
+class HostEeprom {
+ private:
+  byte _bytes[1024];
+
+ public:
+  HostEeprom() {
+    memset(_bytes, 0xFF, sizeof(_bytes));
+  }
+
+  template<class T> T& get(int address, T& value) {
+    memcpy(&value, _bytes + address, sizeof(T));
+    return value;
+  }
+
+  template<class T> const T& put(int address, const T& value) {
+    memcpy(_bytes + address, &value, sizeof(T));
+    return value;
+  }
+};
+
+HostEeprom EEPROM;
+
+inline void halInputPullup(int pin) { }
+inline void halOutput(int pin) { }
+
+inline bool halRead(int pin) {
+  return hostBoard.pins[pin];
+}
+
+inline void halWrite(int pin, bool level) {
+  hostBoard.pins[pin] = level;
+}
+
+inline int halAnalogRead(int pin) {
+  return hostBoard.analogs[pin];
+}
+
+/* Nothing interrupts on a PC; everything gets polled. */
+inline bool halAttachChange(int pin, void (*handler)()) {
+  return false;
+}
+
+inline unsigned long halMicros() {
+  static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+/* No reset flags on a PC. */
+inline byte halResetCause() {
+  return 0;
+}
+
+#define HAL_NOINIT
+
+/* Nothing to hang on a PC. */
+inline void halWatchdogStart(unsigned int ms) { }
+inline void halWatchdogKick() { }
+
+inline void halHidBegin() { }
+
+inline bool halHidReady() {
+  return true;
+}
+
+/* `axes` go X, Y, Z, then the rotations, as in AxisId. */
+inline void halHidSend(unsigned long buttons, const int* axes) {
+  hostBoard.buttons = buttons;
+  memcpy(hostBoard.axes, axes, sizeof(hostBoard.axes));
+  ++hostBoard.reports;
+}
+
+#else
+
+#ifdef __AVR__
+#define FALCONPANEL_AVR
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#endif
+
+inline void halInputPullup(int pin) {
+  pinMode(pin, INPUT_PULLUP);
+}
+
+inline void halOutput(int pin) {
+  pinMode(pin, OUTPUT);
+}
+
+inline bool halRead(int pin) {
+  return digitalRead(pin);
+}
+
+inline void halWrite(int pin, bool level) {
+  digitalWrite(pin, level ? HIGH : LOW);
+}
+
+inline int halAnalogRead(int pin) {
+  return analogRead(pin);
+}
+
+#ifdef FALCONPANEL_AVR
+void (*halChangeHandler)() = 0;
+
+#ifdef PCINT0_vect
+ISR(PCINT0_vect) {
+  halChangeHandler();
+}
+#endif
+#ifdef PCINT1_vect
+ISR(PCINT1_vect) {
+  halChangeHandler();
+}
+#endif
+#ifdef PCINT2_vect
+ISR(PCINT2_vect) {
+  halChangeHandler();
+}
+#endif
+#endif
+
+/* Calls `handler` whenever `pin` changes, from an interrupt. False if
+   the pin can't interrupt. On an AVR, a pin with a pin-change
+   interrupt uses that, and those pins share the vectors, so they all
+   get the last handler anybody asked for. This defines the vectors,
+   so it won't get along with a library that does too, like
+   SoftwareSerial. Pins with an external interrupt use
+   attachInterrupt() either way. */
+inline bool halAttachChange(int pin, void (*handler)()) {
+#ifdef FALCONPANEL_AVR
+  volatile uint8_t* pcicr = digitalPinToPCICR(pin);
+  if (pcicr) {
+    halChangeHandler = handler;
+    *pcicr |= _BV(digitalPinToPCICRbit(pin));
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    return true;
+  }
+#endif
+  int interrupt = digitalPinToInterrupt(pin);
+  if (interrupt == NOT_AN_INTERRUPT) {
+    return false;
+  }
+  attachInterrupt(interrupt, handler, CHANGE);
+  return true;
+}
+
+inline unsigned long halMicros() {
+  return micros();
+}
+
+inline unsigned long halMillis() {
+  return millis();
+}
+
+/* What caused the last reset, as the AVR's MCUSR flags, which get
+   cleared so the next reset starts clean. On a Leonardo, the
+   bootloader gets to them first and clears them itself, so it's
+   usually 0. Other boards say 0 too. */
+inline byte halResetCause() {
+#ifdef FALCONPANEL_AVR
+  byte cause = MCUSR;
+  MCUSR = 0;
+  return cause;
+#else
+  return 0;
+#endif
+}
+
+/* For variables that should keep their value across a reset - not a
+   power cycle. They aren't zeroed at startup, so whoever uses them has
+   to tell for themselves whether what's there means anything. AVR
+   only; elsewhere they're ordinary variables. */
+#ifdef FALCONPANEL_AVR
+#define HAL_NOINIT __attribute__((section(".noinit")))
+#else
+#define HAL_NOINIT
+#endif
+
+/* Resets the board if halWatchdogKick() isn't called for `ms`
+   milliseconds, rounded up to one of the timeouts the AVR's watchdog
+   has, up to two seconds. There's no portable watchdog, so other
+   boards go without. */
+inline void halWatchdogStart(unsigned int ms) {
+#ifdef FALCONPANEL_AVR
+  wdt_enable(ms <= 120 ? WDTO_120MS :
+             ms <= 250 ? WDTO_250MS :
+             ms <= 500 ? WDTO_500MS :
+             ms <= 1000 ? WDTO_1S : WDTO_2S);
+#endif
+}
+
+inline void halWatchdogKick() {
+#ifdef FALCONPANEL_AVR
+#ifdef USBCON
+  // The IDE gets a Leonardo into its bootloader by opening the port at
+  // 1200 baud, and the core does that with a watchdog reset. Kicking
+  // it then would keep the upload from ever starting.
+  if (Serial.baud() == 1200) {
+    return;
+  }
+#endif
+  wdt_reset();
+#endif
+}
+
+#ifndef FALCONPANEL_SATELLITE
+inline void halHidBegin() {
+  Gamepad.begin();
+}
+
+/* True once the host has enumerated the board, so a report will get
+   somewhere. Before then the core throws them away. Boards without
+   native USB are always ready. */
+inline bool halHidReady() {
+#ifdef USBCON
+  return USBDevice.configured();
+#else
+  return true;
+#endif
+}
+
+/* `axes` go X, Y, Z, then the rotations, as in AxisId. */
+inline void halHidSend(unsigned long buttons, const int* axes) {
+  Gamepad.buttons(buttons);
+  Gamepad.xAxis(axes[0]);
+  Gamepad.yAxis(axes[1]);
+  Gamepad.zAxis(axes[2]);
+  Gamepad.rxAxis(axes[3]);
+  Gamepad.ryAxis(axes[4]);
+  Gamepad.rzAxis(axes[5]);
+  Gamepad.write();
+}
+#endif
+
+#endif
+
+/* A digital pin, ready to be read as quickly as the board allows: on
+   an AVR that's its port register and bit, which is quick enough to
+   do from an interrupt. */
+#ifdef FALCONPANEL_AVR
+struct HalPin {
+  volatile uint8_t* in;
+  byte mask;
+};
+
+inline HalPin halPin(int pin) {
+  HalPin fast;
+  fast.in = portInputRegister(digitalPinToPort(pin));
+  fast.mask = digitalPinToBitMask(pin);
+  return fast;
+}
+
+inline bool halReadPin(const HalPin& fast) {
+  return *fast.in & fast.mask;
+}
+
+/* A whole port's worth of pins, read at once. halPort() gives the one
+   a pin's on, and halPortMask() its bit in what halReadPort() reads.
+   Boards that can't read a port all at once say false. */
+typedef volatile uint8_t* HalPort;
+
+inline bool halPort(int pin, HalPort* port) {
+  *port = portInputRegister(digitalPinToPort(pin));
+  return true;
+}
+
+inline byte halReadPort(HalPort port) {
+  return *port;
+}
+
+inline byte halPortMask(const HalPin& fast) {
+  return fast.mask;
+}
+
+/* Starts the ADC converting analog pin `pin` (0 for A0) and returns
+   straight away. halAnalogDone() says when it's finished, and
+   halAnalogResult() has the reading. For reading pots from an
+   interrupt, which can't wait the hundred-odd microseconds
+   halAnalogRead() takes; nobody else should use the ADC meanwhile. */
+inline void halAnalogStart(byte pin) {
+#if defined(ADCSRB) && defined(MUX5)
+  // The same dance analogRead() does on a Leonardo.
+  if (pin >= 18) {
+    pin -= 18;
+  }
+  pin = analogPinToChannel(pin);
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((pin >> 3) & 0x01) << MUX5);
+#else
+  if (pin >= 14) {
+    pin -= 14;
+  }
+#endif
+  ADMUX = (DEFAULT << 6) | (pin & 0x07);
+  ADCSRA |= _BV(ADSC);
+}
+
+inline bool halAnalogDone() {
+  return !(ADCSRA & _BV(ADSC));
+}
+
+inline int halAnalogResult() {
+  return ADC;
+}
+
+void (*halTickHandler)() = 0;
+
+#ifdef TIMER1_COMPA_vect
+ISR(TIMER1_COMPA_vect) {
+  halTickHandler();
+}
+#endif
+
+/* Calls `handler` from a timer interrupt `rate` times a second, from
+   now on. False if the board hasn't got a timer to spare. Call it
+   with interrupts off if the handler mustn't run until you're ready.
+   On an AVR it's Timer1, so it won't get along with the Servo
+   library. */
+inline bool halTickStart(unsigned int rate, void (*handler)()) {
+  halTickHandler = handler;
+  // CTC mode, clocked at F_CPU / 64.
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+  TCNT1 = 0;
+  OCR1A = F_CPU / 64 / rate - 1;
+  TIMSK1 |= _BV(OCIE1A);
+  return true;
+}
+#else
+struct HalPin {
+  int pin;
+};
+
+inline HalPin halPin(int pin) {
+  HalPin fast;
+  fast.pin = pin;
+  return fast;
+}
+
+inline bool halReadPin(const HalPin& fast) {
+  return halRead(fast.pin);
+}
+
+typedef byte HalPort;
+
+inline bool halPort(int pin, HalPort* port) {
+  return false;
+}
+
+inline byte halReadPort(HalPort port) {
+  return 0;
+}
+
+inline byte halPortMask(const HalPin& fast) {
+  return 0;
+}
+
+/* Without an ADC that runs on its own, the conversion happens when
+   the result's asked for. */
+byte halAnalogPin;
+
+inline void halAnalogStart(byte pin) {
+  halAnalogPin = pin;
+}
+
+inline bool halAnalogDone() {
+  return true;
+}
+
+inline int halAnalogResult() {
+  return halAnalogRead(halAnalogPin);
+}
+
+inline bool halTickStart(unsigned int rate, void (*handler)()) {
+  return false;
+}
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+/*
+  falconpanel-bench - runs the panel's components on a PC, against the
+  host backend in hal.h, and times the scan. The same benchmark runs
+  on a board built with FALCONPANEL_BENCH defined, to compare.
+
+  Build:   g++ -O2 -DFALCONPANEL_HOST -o falconpanel-bench host/falconpanel-bench.cpp
+  Run:     falconpanel-bench [scans]
+
+  The components are the ones in panel.h, the same as the sketch's.
+  First it times quiet scans, then it turns the rotary encoder and a
+  pot every scan, with the clock moving on a scan period each time,
+  to see what it costs when things are happening, and prints the
+  report the Gamepad would have been sent.
+*/
+
+#include "../components.h"
+#include "../calibration.h"
+#include "../scanguard.h"
+#include "../diagnostics.h"
+#include "../debounce.h"
+#include "../panel.h"
+#include "../bench.h"
+
+/* Turns the encoder on pins 12 and 13 a step and moves pot 0 on every
+   scan, so every scan has something to report. The encoder's inputs
+   aren't monitored, so turning it doesn't look like a fault; a switch
+   flipped this often would get quarantined. */
+class Wiggle : public Component {
+ private:
+  unsigned int _n;
+
+ public:
+  Wiggle() {
+    _n = 0;
+  }
+
+  virtual void setup() { }
+
+  virtual void update() {
+    ++_n;
+    hostBoard.pins[12] = ((_n + 1) >> 1) & 1;
+    hostBoard.pins[13] = (_n >> 1) & 1;
+    hostBoard.analogs[0] = (_n * 37) % AnalogCounts;
+    microClock.advance(TickMs * 1000UL);
+  }
+};
+
+int main(int argc, char** argv) {
+  unsigned int scans = argc > 1 ? atoi(argv[1]) : 100000;
+  Print out;
+
+  for (int i = 0; i < componentCount; ++i) {
+    components[i]->setup();
+  }
+  for (int i = 0; i < componentCount; ++i) {
+    components[i]->snapshot();
+  }
+
+  out.print("quiet:  ");
+  benchScans(components, componentCount, scans, &out);
+
+  Component* busy[componentCount + 1];
+  busy[0] = new Wiggle();
+  for (int i = 0; i < componentCount; ++i) {
+    busy[i + 1] = components[i];
+  }
+  out.print("moving: ");
+  benchScans(busy, componentCount + 1, scans, &out);
+
+  panelReport.send();
+  printf("report: buttons %08lx, x rotation %d, %lu sent, %d faulty\n",
+         hostBoard.buttons, hostBoard.axes[AxisXRotation], hostBoard.reports,
+         diagnostics.faults());
+  return 0;
+}
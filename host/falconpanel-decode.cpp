@@ -0,0 +1,172 @@
+/*
+  falconpanel-decode - turns the binary event stream from a
+  Falconpanel board into something a person, or a spreadsheet, can
+  read. Reads from the board's serial port, or from a capture of it
+  (say, one made with `cat /dev/ttyACM0 > capture.bin`), or from
+  standard input if given "-".
+
+  Build:   g++ -O2 -o falconpanel-decode host/falconpanel-decode.cpp
+  Run:     falconpanel-decode -e /dev/ttyACM0 > events.csv
+
+  Each record comes out as a line of CSV:
+
+    time_us,delta_us,sequence,component,kind,index,value
+
+  where time_us is the board's micros() when the change happened,
+  delta_us is the time since the record before it, and component is
+  blank for changes that happened outside the scan. When the input
+  ends, or on ^C, a summary goes to stderr: how many records, how many
+  the board dropped, the event rate, and the busiest components.
+
+  Options:
+    -e    send 'e' first to turn the event stream on
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "records.h"
+
+class CsvHandler : public RecordHandler {
+ private:
+  bool _started;
+  uint32_t _last;
+
+ public:
+  unsigned long perComponent[256];
+  unsigned long buttons;
+  unsigned long axes;
+  unsigned long long spanUs;
+
+  CsvHandler() {
+    _started = false;
+    _last = 0;
+    memset(perComponent, 0, sizeof(perComponent));
+    buttons = 0;
+    axes = 0;
+    spanUs = 0;
+    printf("time_us,delta_us,sequence,component,kind,index,value\n");
+  }
+
+  virtual void record(const Event* event) {
+    uint32_t delta = _started ? event->time - _last : 0;
+    _started = true;
+    _last = event->time;
+    // micros() wraps every 71 minutes; adding up the deltas keeps the
+    // span right across that.
+    spanUs += delta;
+
+    printf("%u,%u,%u,", event->time, delta, event->sequence);
+    if (event->component != EventNoComponent) {
+      printf("%u", event->component);
+    }
+    printf(",%s,%u,%d\n",
+           event->kind == EventButton ? "button" : "axis",
+           event->index, event->value);
+
+    ++perComponent[event->component];
+    if (event->kind == EventButton) {
+      ++buttons;
+    }
+    else {
+      ++axes;
+    }
+  }
+
+  virtual void flush() {
+    fflush(stdout);
+  }
+};
+
+volatile sig_atomic_t running = 1;
+
+void stop(int) {
+  running = 0;
+}
+
+void usage() {
+  fprintf(stderr, "usage: falconpanel-decode [-e] device|file|-\n");
+  exit(2);
+}
+
+void summarize(RecordReader* reader, CsvHandler* handler) {
+  fprintf(stderr, "%lu records (%lu buttons, %lu axes), %lu dropped, %lu bytes skipped\n",
+          reader->records, handler->buttons, handler->axes,
+          reader->dropped, reader->skipped);
+  if (handler->spanUs > 0) {
+    fprintf(stderr, "%.3f s of board time, %.1f events/s\n",
+            handler->spanUs / 1e6, reader->records * 1e6 / handler->spanUs);
+  }
+
+  // The five busiest components, which is usually where to look when
+  // something's chattering.
+  bool shown[256] = { false };
+  for (int rank = 0; rank < 5; ++rank) {
+    int busiest = -1;
+    for (int i = 0; i < 256; ++i) {
+      if (!shown[i] && handler->perComponent[i] > 0 &&
+          (busiest < 0 || handler->perComponent[i] > handler->perComponent[busiest])) {
+        busiest = i;
+      }
+    }
+    if (busiest < 0) {
+      break;
+    }
+    shown[busiest] = true;
+    if (busiest == EventNoComponent) {
+      fprintf(stderr, "  outside the scan: %lu\n", handler->perComponent[busiest]);
+    }
+    else {
+      fprintf(stderr, "  component %d: %lu\n", busiest, handler->perComponent[busiest]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  bool enable = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e")) != -1) {
+    if (opt == 'e') {
+      enable = true;
+    }
+    else {
+      usage();
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  int fd;
+  if (strcmp(argv[optind], "-") == 0) {
+    fd = 0;
+  }
+  else {
+    fd = open(argv[optind], (enable ? O_RDWR : O_RDONLY) | O_NOCTTY);
+    if (fd < 0) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  rawMode(fd);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+
+  if (enable && write(fd, "e", 1) < 0) {
+    perror("falconpanel-decode: enabling the event stream");
+  }
+
+  RecordReader reader;
+  CsvHandler handler;
+  while (running && reader.read(fd, &handler)) {
+  }
+
+  summarize(&reader, &handler);
+  return 0;
+}
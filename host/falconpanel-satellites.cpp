@@ -0,0 +1,174 @@
+/*
+  falconpanel-satellites - puts a master and a few satellites on a
+  pretend bus on a PC, against the host backend in hal.h, and checks
+  that what the master would send the host is what the boards between
+  them have set.
+
+  Build:   g++ -O2 -DFALCONPANEL_HOST -o falconpanel-satellites host/falconpanel-satellites.cpp
+  Run:     falconpanel-satellites
+
+  Each satellite has its own Report, and an Uplink whose frames sit in
+  its encoder until the master's link for it pulls them, a chunk at a
+  time and padded with FrameIdle, the way I2C does it. It prints a
+  line per check and exits non-zero if any of them failed.
+*/
+
+#include "../components.h"
+#include "../satellite.h"
+
+/* A satellite's end: frames wait in the encoder until they're asked
+   for. */
+class MemoryUplink : public Uplink {
+ protected:
+  virtual void flush() { }
+
+ public:
+  virtual void setup() { }
+
+  byte available() {
+    return _encoder.available();
+  }
+
+  byte read() {
+    return _encoder.read();
+  }
+};
+
+/* The master's end: every poll pulls `chunk` bytes from the
+   satellite, padding with FrameIdle once it runs out. */
+class MemoryLink : public SatelliteLink {
+ private:
+  MemoryUplink* _uplink;
+  byte _chunk;
+
+ public:
+  MemoryLink(MemoryUplink* uplink, byte chunk = 16) {
+    _uplink = uplink;
+    _chunk = chunk;
+  }
+
+  virtual void setup() { }
+
+  virtual void poll() {
+    for (byte i = 0; i < _chunk; ++i) {
+      _decoder.feed(_uplink->available() > 0 ? _uplink->read() : FrameIdle);
+    }
+  }
+};
+
+const byte SatelliteCount = 3;
+
+SatelliteHub hub(SatelliteCount);
+Report boards[SatelliteCount];
+MemoryUplink uplinks[SatelliteCount];
+
+int failures = 0;
+
+void check(const char* what, long got, long want) {
+  printf("%s %s: got %ld, want %ld\n", got == want ? "ok  " : "FAIL", what, got, want);
+  if (got != want) {
+    ++failures;
+  }
+}
+
+/* Every satellite sends what it has, and the master polls until
+   everything's across. The hub polls one satellite each time. */
+void pump() {
+  for (int round = 0; round < 8 * SatelliteCount; ++round) {
+    for (byte i = 0; i < SatelliteCount; ++i) {
+      uplinks[i].send(&boards[i]);
+    }
+    hub.expire();
+  }
+}
+
+Report merged() {
+  Report merged = panelReport;
+  hub.mergeInto(&merged);
+  return merged;
+}
+
+int main() {
+  for (byte i = 0; i < SatelliteCount; ++i) {
+    hub.add(new MemoryLink(&uplinks[i]));
+  }
+
+  // The master has its own button and an axis of its own - the HMCS
+  // on the X rotation, say.
+  panelReport.setButton(1, true);
+  panelReport.setAxis(AxisXRotation, 1234);
+
+  // One satellite has two buttons down and a Y axis, one has a button
+  // and a Z axis, and one has nothing on at all.
+  boards[0].setButton(10, true);
+  boards[0].setButton(11, true);
+  boards[0].setAxis(AxisY, 500);
+  boards[1].setButton(20, true);
+  boards[1].setAxis(AxisZ, 77);
+
+  pump();
+  Report report = merged();
+  check("buttons", report.buttons(), (1UL << 0) | (1UL << 9) | (1UL << 10) | (1UL << 19));
+  check("master's x rotation", report.axis(AxisXRotation), 1234);
+  check("y from satellite 0", report.axis(AxisY), 500);
+  check("z from satellite 1", report.axis(AxisZ), 77);
+  check("x nobody drives", report.axis(AxisX), 0);
+
+  // The once-a-second refresh sends everything again. It mustn't send
+  // axes the satellites don't drive.
+  for (byte i = 0; i < SatelliteCount; ++i) {
+    uplinks[i].expire();
+  }
+  pump();
+  report = merged();
+  check("buttons after refresh", report.buttons(), (1UL << 0) | (1UL << 9) | (1UL << 10) | (1UL << 19));
+  check("master's x rotation after refresh", report.axis(AxisXRotation), 1234);
+  check("y after refresh", report.axis(AxisY), 500);
+
+  // Changes get across too.
+  boards[0].setButton(11, false);
+  boards[0].setAxis(AxisY, 600);
+  boards[2].setButton(32, true);
+  pump();
+  report = merged();
+  check("buttons after changes", report.buttons(), (1UL << 0) | (1UL << 9) | (1UL << 19) | (1UL << 31));
+  check("y after changes", report.axis(AxisY), 600);
+  check("master's x rotation after changes", report.axis(AxisXRotation), 1234);
+
+  // Each poll asks one satellite, in turn.
+  boards[0].setButton(12, true);
+  boards[1].setButton(21, true);
+  for (byte i = 0; i < SatelliteCount; ++i) {
+    uplinks[i].send(&boards[i]);
+  }
+  hub.expire();
+  report = merged();
+  check("first poll hears satellite 0", bitRead(report.buttons(), 11), 1);
+  check("first poll doesn't hear satellite 1", bitRead(report.buttons(), 20), 0);
+  hub.expire();
+  report = merged();
+  check("second poll hears satellite 1", bitRead(report.buttons(), 20), 1);
+
+  // Axes are signed, and the ends of the range make it across.
+  boards[0].setAxis(AxisY, -5);
+  boards[1].setAxis(AxisZ, -32768);
+  boards[2].setAxis(AxisYRotation, 32767);
+  pump();
+  report = merged();
+  check("negative y", report.axis(AxisY), -5);
+  check("lowest z", report.axis(AxisZ), -32768);
+  check("highest y rotation", report.axis(AxisYRotation), 32767);
+
+  // And they survive the refresh.
+  for (byte i = 0; i < SatelliteCount; ++i) {
+    uplinks[i].expire();
+  }
+  pump();
+  report = merged();
+  check("negative y after refresh", report.axis(AxisY), -5);
+  check("lowest z after refresh", report.axis(AxisZ), -32768);
+  check("highest y rotation after refresh", report.axis(AxisYRotation), 32767);
+
+  printf("%s\n", failures ? "FAILED" : "passed");
+  return failures ? 1 : 0;
+}
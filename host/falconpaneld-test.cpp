@@ -0,0 +1,259 @@
+/*
+  falconpaneld-test - plays the part of a board to falconpaneld over a
+  pseudo-terminal, with the print sink standing in for the virtual
+  joystick, and checks that what comes out is what went in.
+
+  Build:   g++ -O2 -o falconpaneld host/falconpaneld.cpp
+           g++ -O2 -o falconpaneld-test host/falconpaneld-test.cpp
+  Run:     falconpaneld-test ./falconpaneld
+
+  It starts falconpaneld on the pty's far end with -s print, waits for
+  the 'e' that turns the stream on, and then sends it:
+
+  - some text and half a record, which it should skip, then a record
+  - a record of every kind, including a negative axis
+  - a few hundred records one at a time, timing each one from the
+    write to its line coming out
+  - twenty thousand records in one go, timing the lot
+
+  It prints a line per check and exits non-zero if any of them failed.
+*/
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "records.h"
+
+int failures = 0;
+
+void check(const char* what, long got, long want) {
+  printf("%s %s: got %ld, want %ld\n", got == want ? "ok  " : "FAIL", what, got, want);
+  if (got != want) {
+    ++failures;
+  }
+}
+
+unsigned long long nowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* The board's end of the pty, and falconpaneld's standard output.
+   Both are non-blocking: with twenty thousand records in flight the
+   pty and the pipe both fill up, and whichever of us blocked first
+   would hold up the other for good. So what we send waits in the
+   outbox and goes out a bit at a time while we read. */
+int board;
+int daemonOut;
+uint8_t* outbox;
+size_t outboxSize = 0;
+size_t outboxSent = 0;
+char lines[65536];
+size_t linesSize = 0;
+uint8_t sequence = 0;
+
+void sendBytes(const void* bytes, size_t size) {
+  if (outboxSent == outboxSize) {
+    outboxSent = 0;
+    outboxSize = 0;
+  }
+  memcpy(outbox + outboxSize, bytes, size);
+  outboxSize += size;
+}
+
+void encode(uint8_t kind, uint8_t index, int16_t value, uint32_t time, uint8_t* buf) {
+  Event event;
+  event.kind = kind;
+  event.component = 3;
+  event.index = index;
+  event.value = value;
+  event.time = time;
+  event.sequence = sequence++;
+  encodeEvent(&event, buf);
+}
+
+void sendEvent(uint8_t kind, uint8_t index, int16_t value, uint32_t time) {
+  uint8_t buf[EventRecordSize];
+  encode(kind, index, value, time, buf);
+  sendBytes(buf, sizeof(buf));
+}
+
+/* The next line falconpaneld prints, or an empty string if it hasn't
+   printed one within a couple of seconds. Sends what's in the outbox
+   while it waits. */
+const char* nextLine() {
+  static char line[128];
+  for (;;) {
+    char* end = (char*)memchr(lines, '\n', linesSize);
+    if (end) {
+      size_t size = end - lines + 1;
+      size_t kept = size < sizeof(line) ? size : sizeof(line) - 1;
+      memcpy(line, lines, kept);
+      line[kept] = 0;
+      memmove(lines, lines + size, linesSize - size);
+      linesSize -= size;
+      return line;
+    }
+
+    struct pollfd pfd[2];
+    pfd[0].fd = daemonOut;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = board;
+    pfd[1].events = outboxSent < outboxSize ? POLLOUT : 0;
+    if (poll(pfd, 2, 2000) <= 0) {
+      line[0] = 0;
+      return line;
+    }
+    if (pfd[1].revents & POLLOUT) {
+      ssize_t n = write(board, outbox + outboxSent, outboxSize - outboxSent);
+      if (n > 0) {
+        outboxSent += n;
+      }
+    }
+    if (pfd[0].revents & (POLLIN | POLLHUP)) {
+      ssize_t n = read(daemonOut, lines + linesSize, sizeof(lines) - linesSize);
+      if (n > 0) {
+        linesSize += n;
+      }
+      else if (n == 0 || errno != EAGAIN) {
+        line[0] = 0;
+        return line;
+      }
+    }
+  }
+}
+
+/* Checks that the next line is the event given. */
+void expect(const char* what, const char* kind, int index, int value, uint32_t time) {
+  char want[128];
+  snprintf(want, sizeof(want), "%10u %s %d %d\n", time, kind, index, value);
+  const char* got = nextLine();
+  bool same = strcmp(got, want) == 0;
+  printf("%s %s: got \"%.*s\"\n", same ? "ok  " : "FAIL", what,
+         (int)strcspn(got, "\n"), got);
+  if (!same) {
+    ++failures;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: falconpaneld-test path/to/falconpaneld\n");
+    return 2;
+  }
+
+  board = posix_openpt(O_RDWR | O_NOCTTY);
+  if (board < 0 || grantpt(board) < 0 || unlockpt(board) < 0) {
+    perror("falconpaneld-test: pty");
+    return 1;
+  }
+  const char* port = ptsname(board);
+  const int flood = 20000;
+  outbox = new uint8_t[flood * EventRecordSize];
+
+  int out[2];
+  if (pipe(out) < 0) {
+    perror("falconpaneld-test: pipe");
+    return 1;
+  }
+  pid_t daemon = fork();
+  if (daemon == 0) {
+    dup2(out[1], 1);
+    close(out[0]);
+    close(board);
+    execl(argv[1], argv[1], "-s", "print", port, (char*)0);
+    perror(argv[1]);
+    _exit(127);
+  }
+  close(out[1]);
+  daemonOut = out[0];
+  fcntl(daemonOut, F_SETFL, O_NONBLOCK);
+
+  // falconpaneld puts the port in raw mode before it asks for the
+  // stream, so nothing sent after the 'e' gets mangled by the line
+  // discipline.
+  struct pollfd pfd;
+  pfd.fd = board;
+  pfd.events = POLLIN;
+  char asked = 0;
+  if (poll(&pfd, 1, 2000) > 0) {
+    if (read(board, &asked, 1) != 1) {
+      asked = 0;
+    }
+  }
+  check("asks for the stream", asked, 'e');
+  fcntl(board, F_SETFL, O_NONBLOCK);
+
+  // The board answers commands in text down the same port, and the
+  // daemon may come in halfway through a record.
+  const char text[] = "calibrated\r\n";
+  sendBytes(text, sizeof(text) - 1);
+  uint8_t half[EventRecordSize];
+  encode(EventButton, 9, 1, 999, half);
+  sendBytes(half, EventRecordSize / 2);
+  sendEvent(EventButton, 1, 1, 1000);
+  expect("skips text and half a record", "button", 1, 1, 1000);
+
+  sendEvent(EventButton, 86, 1, 2000);
+  expect("button past 32", "button", 86, 1, 2000);
+  sendEvent(EventButton, 86, 0, 2100);
+  expect("release", "button", 86, 0, 2100);
+  sendEvent(EventAxis, 3, -32768, 3000);
+  expect("negative axis", "axis", 3, -32768, 3000);
+  sendEvent(EventAxis, 0, 32767, 4000);
+  expect("highest axis", "axis", 0, 32767, 4000);
+
+  // One at a time: what falconpaneld adds to every change.
+  const int pings = 500;
+  unsigned long long worst = 0;
+  unsigned long long total = 0;
+  int late = 0;
+  for (int i = 0; i < pings; ++i) {
+    char want[128];
+    snprintf(want, sizeof(want), "%10u button %d %d\n", 5000 + i, 2, i & 1);
+    unsigned long long start = nowUs();
+    sendEvent(EventButton, 2, i & 1, 5000 + i);
+    if (strcmp(nextLine(), want) != 0) {
+      ++late;
+      continue;
+    }
+    unsigned long long took = nowUs() - start;
+    total += took;
+    worst = took > worst ? took : worst;
+  }
+  check("one at a time, all through in order", pings - late, pings);
+  printf("     one at a time: average %lluus, worst %lluus\n", total / pings, worst);
+  check("one at a time, under a millisecond on average", total / pings < 1000, 1);
+
+  // A flood, as fast as the pty will take it.
+  unsigned long long start = nowUs();
+  for (int i = 0; i < flood; ++i) {
+    sendEvent(EventAxis, i % 6, i - flood / 2, 100000 + i);
+  }
+  int through = 0;
+  for (int i = 0; i < flood; ++i) {
+    char want[128];
+    snprintf(want, sizeof(want), "%10u axis %d %d\n", 100000 + i, i % 6, i - flood / 2);
+    if (strcmp(nextLine(), want) != 0) {
+      break;
+    }
+    ++through;
+  }
+  unsigned long long took = nowUs() - start;
+  check("flood, all through in order", through, flood);
+  printf("     flood: %d records in %llums, %llu a second\n", flood, took / 1000,
+         took ? flood * 1000000ULL / took : 0);
+
+  kill(daemon, SIGTERM);
+  int status = 0;
+  waitpid(daemon, &status, 0);
+  check("exits cleanly on SIGTERM", WIFEXITED(status) ? WEXITSTATUS(status) : -1, 0);
+
+  printf("%s\n", failures ? "FAILED" : "passed");
+  return failures ? 1 : 0;
+}
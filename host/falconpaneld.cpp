@@ -0,0 +1,265 @@
+/*
+  falconpaneld - reads the binary event stream from a Falconpanel
+  board over its serial port and replays it through a virtual input
+  device, so a Linux host sees the panel without going through the
+  Gamepad's HID descriptor, and so without its 32-button limit.
+
+  Build:   g++ -O2 -o falconpaneld host/falconpaneld.cpp
+  Run:     falconpaneld /dev/ttyACM0
+
+  Options:
+    -s uinput   send events to a virtual input device (the default)
+    -s print    print events to stdout instead; handy for trying
+                things out against a pseudo-terminal, no root needed
+    -v          print event counts to stderr once a second
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "records.h"
+
+/* Mirrors AxisId in components.h. */
+const int axisCodes[] = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ };
+const int axisCount = sizeof(axisCodes) / sizeof(int);
+
+/* Z and Z rotation are 8-bit axes on the board; the rest are 16. */
+bool narrowAxis(int axis) {
+  return axis == 2 || axis == 5;
+}
+
+/* Maps a Falconpanel button number (from 1) to a key code. The
+   joystick buttons run out at 16, so after that we go on to the
+   "trigger happy" buttons and then the macro keys. Zero means the
+   number is out of range. */
+int buttonCode(int num) {
+  if (num < 1) {
+    return 0;
+  }
+  if (num <= 16) {
+    return BTN_JOYSTICK + num - 1;
+  }
+  if (num <= 16 + 40) {
+    return BTN_TRIGGER_HAPPY1 + num - 17;
+  }
+  if (num <= 16 + 40 + 30) {
+    return KEY_MACRO1 + num - 57;
+  }
+  return 0;
+}
+
+const int maxButtons = 16 + 40 + 30;
+
+/* Where decoded events end up. */
+class Sink : public RecordHandler {
+ public:
+  virtual bool open() = 0;
+  virtual void button(int num, bool state, uint32_t time) = 0;
+  virtual void axis(int axis, int value, uint32_t time) = 0;
+
+  virtual void record(const Event* event) {
+    if (event->kind == EventButton) {
+      button(event->index, event->value != 0, event->time);
+    }
+    else if (event->kind == EventAxis) {
+      axis(event->index, event->value, event->time);
+    }
+  }
+};
+
+/* Prints each event on a line of its own. */
+class PrintSink : public Sink {
+ public:
+  virtual bool open() {
+    return true;
+  }
+
+  virtual void button(int num, bool state, uint32_t time) {
+    printf("%10u button %d %d\n", time, num, state ? 1 : 0);
+  }
+
+  virtual void axis(int axis, int value, uint32_t time) {
+    printf("%10u axis %d %d\n", time, axis, value);
+  }
+
+  virtual void flush() {
+    fflush(stdout);
+  }
+};
+
+/* A virtual joystick, courtesy of /dev/uinput. */
+class UinputSink : public Sink {
+ private:
+  int _fd;
+  bool _pending;
+
+  void emit(int type, int code, int value) {
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    if (write(_fd, &ev, sizeof(ev)) < 0) {
+      perror("falconpaneld: uinput write");
+    }
+  }
+
+ public:
+  UinputSink() {
+    _fd = -1;
+    _pending = false;
+  }
+
+  virtual ~UinputSink() {
+    if (_fd >= 0) {
+      ioctl(_fd, UI_DEV_DESTROY);
+      close(_fd);
+    }
+  }
+
+  virtual bool open() {
+    _fd = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (_fd < 0) {
+      perror("falconpaneld: /dev/uinput");
+      return false;
+    }
+
+    struct uinput_user_dev dev;
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "Falconpanel");
+    dev.id.bustype = BUS_VIRTUAL;
+    dev.id.vendor = 0x1209;
+    dev.id.product = 0xFA1C;
+    dev.id.version = 1;
+
+    ioctl(_fd, UI_SET_EVBIT, EV_KEY);
+    for (int num = 1; num <= maxButtons; ++num) {
+      ioctl(_fd, UI_SET_KEYBIT, buttonCode(num));
+    }
+
+    ioctl(_fd, UI_SET_EVBIT, EV_ABS);
+    for (int i = 0; i < axisCount; ++i) {
+      ioctl(_fd, UI_SET_ABSBIT, axisCodes[i]);
+      dev.absmin[axisCodes[i]] = narrowAxis(i) ? -128 : -32768;
+      dev.absmax[axisCodes[i]] = narrowAxis(i) ? 127 : 32767;
+    }
+
+    if (write(_fd, &dev, sizeof(dev)) < 0 || ioctl(_fd, UI_DEV_CREATE) < 0) {
+      perror("falconpaneld: creating uinput device");
+      return false;
+    }
+    return true;
+  }
+
+  virtual void button(int num, bool state, uint32_t) {
+    int code = buttonCode(num);
+    if (code) {
+      emit(EV_KEY, code, state ? 1 : 0);
+      _pending = true;
+    }
+  }
+
+  virtual void axis(int axis, int value, uint32_t) {
+    if (axis >= 0 && axis < axisCount) {
+      // The narrow axes arrive the way the Gamepad wants them: a
+      // signed byte in the bottom eight bits.
+      emit(EV_ABS, axisCodes[axis], narrowAxis(axis) ? int8_t(value) : value);
+      _pending = true;
+    }
+  }
+
+  virtual void flush() {
+    if (_pending) {
+      emit(EV_SYN, SYN_REPORT, 0);
+      _pending = false;
+    }
+  }
+};
+
+volatile sig_atomic_t running = 1;
+
+void stop(int) {
+  running = 0;
+}
+
+void usage() {
+  fprintf(stderr, "usage: falconpaneld [-s uinput|print] [-v] device\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  const char* sinkName = "uinput";
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:v")) != -1) {
+    if (opt == 's') {
+      sinkName = optarg;
+    }
+    else if (opt == 'v') {
+      verbose = true;
+    }
+    else {
+      usage();
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  Sink* sink;
+  if (strcmp(sinkName, "uinput") == 0) {
+    sink = new UinputSink();
+  }
+  else if (strcmp(sinkName, "print") == 0) {
+    sink = new PrintSink();
+  }
+  else {
+    usage();
+  }
+
+  int fd = open(argv[optind], O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (!rawMode(fd) && verbose) {
+    fprintf(stderr, "falconpaneld: %s isn't a terminal; reading it as-is\n", argv[optind]);
+  }
+  if (!sink->open()) {
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+
+  // Ask the board to start streaming.
+  if (write(fd, "e", 1) < 0 && verbose) {
+    perror("falconpaneld: enabling the event stream");
+  }
+
+  RecordReader reader;
+  time_t lastReport = time(0);
+  unsigned long lastRecords = 0;
+
+  while (running && reader.read(fd, sink)) {
+    if (verbose && time(0) != lastReport) {
+      lastReport = time(0);
+      fprintf(stderr, "falconpaneld: %lu events/s, %lu dropped, %lu bytes skipped\n",
+              reader.records - lastRecords, reader.dropped, reader.skipped);
+      lastRecords = reader.records;
+    }
+  }
+
+  delete sink;
+  close(fd);
+  return 0;
+}
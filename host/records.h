@@ -0,0 +1,101 @@
+#ifndef _RECORDS_H
+#define _RECORDS_H
+
+/* The host end of the serial event stream, shared by falconpaneld and
+   falconpanel-decode. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../events.h"
+
+/* Where decoded records end up. */
+class RecordHandler {
+ public:
+  virtual ~RecordHandler() { }
+  virtual void record(const Event* event) = 0;
+
+  /* Called after each batch of records read in one go, which is the
+     time to push anything buffered along. */
+  virtual void flush() { }
+};
+
+/* Picks records out of the byte stream, skipping anything that isn't
+   one - the board's text replies to serial commands, or the tail of a
+   record we came in halfway through - and counting the records the
+   board dropped from gaps in the sequence numbers. */
+class RecordReader {
+ private:
+  uint8_t _buf[4096];
+  size_t _size;
+  bool _started;
+  uint8_t _nextSequence;
+
+ public:
+  unsigned long records;
+  unsigned long dropped;
+  unsigned long skipped;
+
+  RecordReader() {
+    _size = 0;
+    _started = false;
+    _nextSequence = 0;
+    records = 0;
+    dropped = 0;
+    skipped = 0;
+  }
+
+  /* Reads what's waiting on `fd` and hands every complete record to
+     `handler`. Returns false on end of file or error. */
+  bool read(int fd, RecordHandler* handler) {
+    ssize_t n = ::read(fd, _buf + _size, sizeof(_buf) - _size);
+    if (n <= 0) {
+      return n < 0 && (errno == EINTR || errno == EAGAIN);
+    }
+    _size += n;
+
+    size_t pos = 0;
+    while (_size - pos >= EventRecordSize) {
+      Event event;
+      if (!decodeEvent(_buf + pos, &event)) {
+        ++pos;
+        ++skipped;
+        continue;
+      }
+      if (_started) {
+        dropped += uint8_t(event.sequence - _nextSequence);
+      }
+      _started = true;
+      _nextSequence = event.sequence + 1;
+      handler->record(&event);
+      pos += EventRecordSize;
+      ++records;
+    }
+    handler->flush();
+
+    memmove(_buf, _buf + pos, _size - pos);
+    _size -= pos;
+    return true;
+  }
+};
+
+/* Puts a serial port in raw mode, so every byte comes through as soon
+   as it arrives. False if `fd` isn't a terminal, which is fine if
+   it's a file. */
+bool rawMode(int fd) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) < 0) {
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _PANEL_H
+#define _PANEL_H
+
+/* The panel itself: what's wired to which pin, and which DirectX
+   button or axis each control drives. Change this to match what you
+   have. It's in a header of its own so the sketch and the PC
+   benchmark (host/falconpanel-bench.cpp) build the same panel; include
+   it after components.h, calibration.h, diagnostics.h and
+   debounce.h. */
+
+// I've got a 74LS151 3-to-8 mux with its address pins connected to
+// Arduino pins 2-4, and with its output pin connected to Arduino pin
+// 5. We have to declare this outside the components array below
+// because we reference it in there.
+IC74LS151* mux1 = new IC74LS151(new DigitalOutputPin(2),
+                                new DigitalOutputPin(3),
+                                new DigitalOutputPin(4),
+                                new DigitalInputPullupPin(5));
+
+// The switches' inputs go through monitored(), which notices wiring
+// faults and keeps a chattering input from spamming the host. The
+// rotary encoder's aren't: spinning the knob changes them faster than
+// any switch ever would. The switches on pins that interrupt also go
+// through debounced(), which learns how long each one bounces for.
+
+// Keep track of the button number so I don't have to keep looking at
+// what I used.
+int dxButton = 1;
+
+// Configure our particular setup. Change this to match what you have.
+Component* components[] =   {
+  // List the mux here so its setup gets called
+  mux1,
+  // Master Arm
+  new OnOffOnSwitch(monitored(mux1->input(0)),
+                    monitored(mux1->input(1)),
+                    new MomentaryButton(new DxButton(dxButton++)),
+                    new MomentaryButton(new DxButton(dxButton++)),
+                    new MomentaryButton(new DxButton(dxButton++))),
+  // Laser Arm
+  new OnOffSwitch(monitored(mux1->input(2)),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Emergency Stores Jettison
+  new PushButton(monitored(mux1->input(3)), new DxButton(dxButton++)),
+  // Parking Brake
+  new OnOffSwitch(monitored(new DigitalInputPullupPin(6)),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Stores config
+  new OnOffSwitch(monitored(debounced(new DigitalInputPullupPin(7))),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Taxi Lights
+  new OnOffSwitch(monitored(mux1->input(4)),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Landing Gear
+  new OnOffSwitch(monitored(mux1->input(5)),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // HMCS
+  new SwitchingRotary(new CalibratedAnalogInput(new AnalogInputPin(0), 0),
+                      DxAxis::XRotation(),
+                      new MomentaryButton(new DxButton(dxButton++)),
+                      new MomentaryButton(new DxButton(dxButton++)),
+                      0.05),
+  // Chaff
+  new OnOffSwitch(monitored(debounced(new DigitalInputPullupPin(8))),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Flares
+  new OnOffSwitch(monitored(debounced(new DigitalInputPullupPin(9))),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Altimeter
+  new PulseRotary(new AnalogInputPin(1),
+                  new MomentaryButton(new DxButton(dxButton++), 1),
+                  new MomentaryButton(new DxButton(dxButton++), 1),
+                  16),
+  // A/R Door
+  new OnOffSwitch(monitored(debounced(new DigitalInputPullupPin(10))),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // Master Lights
+  new OnOffSwitch(monitored(debounced(new DigitalInputPullupPin(11))),
+                  new MomentaryButton(new DxButton(dxButton++)),
+                  new MomentaryButton(new DxButton(dxButton++))),
+  // AVCD
+  new OnOffOnSwitch(monitored(mux1->input(6)),
+                    monitored(mux1->input(7)),
+                    new MomentaryButton(new DxButton(dxButton++)),
+                    new MomentaryButton(new DxButton(dxButton++)),
+                    new MomentaryButton(new DxButton(dxButton++))),
+                    
+  // Altimeter adjustment
+  new RotaryEncoder(new DigitalInputPullupPin(12),
+                    new DigitalInputPullupPin(13),
+                    new DxButton(dxButton++),
+                    new DxButton(dxButton++),
+                    4)
+};
+
+const int componentCount = sizeof(components)/sizeof(Component*);
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef _POWER_H
+#define _POWER_H
+
+#ifdef FALCONPANEL_AVR
+#include <avr/sleep.h>
+#endif
+
+/* A cockpit spends most of its time with nobody touching it, and
+   there's no reason to spin the CPU flat out waiting. Once nothing has
+   changed for `idleAfter` milliseconds, the board goes idle: between
+   scans it sleeps instead of spinning, and the loop scans less often.
+
+   The sleep is the AVR's idle mode, which leaves the clocks running,
+   so USB stays connected and millis() keeps counting. Any interrupt
+   wakes it up: the timer that drives millis() does every millisecond,
+   the USB start-of-frame does too, and so does a watched pin. So a
+   watched switch is handled as soon as it changes, asleep or not.
+   The first change after going idle gets its latency measured anyway,
+   from the pin's interrupt to the start of the update. Anything that
+   has to be scanned waits up to one idle scan period.
+
+   Only an AVR sleeps; anything else just goes idle and scans less.
+
+   Send 'p' over the serial port for the numbers. */
+class Power {
+ private:
+  unsigned long _idleAfter;
+  unsigned long _lastActivity;
+  bool _idle;
+  unsigned long long _asleepUs;
+  unsigned long long _scanningUs;
+  unsigned long _lastWakeUs;
+  unsigned long _maxWakeUs;
+  unsigned long _wakes;
+
+  void sleep() {
+#ifdef FALCONPANEL_AVR
+    // Interrupts stay off between checking for an edge and going to
+    // sleep, or an edge in between would leave us asleep until the
+    // next tick. sleep_cpu() always runs the instruction after sei,
+    // so nothing gets in there.
+    noInterrupts();
+    if (pinWatch.pending()) {
+      interrupts();
+      return;
+    }
+    unsigned long start = microClock.us();
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+    _asleepUs += microClock.us() - start;
+#endif
+  }
+
+ public:
+  Power(unsigned long idleAfter = 10000) {
+    _idleAfter = idleAfter;
+    _lastActivity = 0;
+    _idle = false;
+    _asleepUs = 0;
+    _scanningUs = 0;
+    _lastWakeUs = 0;
+    _maxWakeUs = 0;
+    _wakes = 0;
+  }
+
+  void setup() {
+#ifdef FALCONPANEL_AVR
+    set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+    _lastActivity = panelClock.now();
+  }
+
+  /* Something changed; stay awake. */
+  void activity() {
+    _lastActivity = panelClock.now();
+    _idle = false;
+  }
+
+  bool idle() {
+    if (!_idle && panelClock.now() - _lastActivity >= _idleAfter) {
+      _idle = true;
+    }
+    return _idle;
+  }
+
+  /* A watched pin changed `latency` microseconds ago and is being
+     handled now. */
+  void edge(unsigned long latency) {
+    if (_idle) {
+      _lastWakeUs = latency;
+      _maxWakeUs = max(_maxWakeUs, latency);
+      ++_wakes;
+    }
+    activity();
+  }
+
+  void scanned(unsigned long us) {
+    _scanningUs += us;
+  }
+
+  /* Waits up to `ms` milliseconds, or until a watched pin changes,
+     unless `settling`, in which case it waits the whole time. Sleeps
+     while it's at it, if we're idle. */
+  void wait(unsigned long ms, bool settling) {
+    unsigned long start = microClock.ms();
+    while (microClock.ms() - start < ms && (settling || !pinWatch.pending())) {
+      if (_idle) {
+        sleep();
+      }
+    }
+  }
+
+  void status(Print* out) {
+    out->print(idle() ? F("idle") : F("active"));
+    out->print(F(", up "));
+    out->print(microClock.ms());
+    out->print(F("ms, asleep "));
+    out->print((unsigned long)(_asleepUs / 1000));
+    out->print(F("ms, scanning "));
+    out->print((unsigned long)(_scanningUs / 1000));
+    out->println(F("ms"));
+    out->print(F("wakes: "));
+    out->print(_wakes);
+    out->print(F(", latency last "));
+    out->print(_lastWakeUs);
+    out->print(F("us, max "));
+    out->print(_maxWakeUs);
+    out->println(F("us"));
+  }
+};
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef _SATELLITE_H
+#define _SATELLITE_H
+
+#ifndef FALCONPANEL_HOST
+#include <Wire.h>
+#endif
+
+/* Support for spreading a panel over several boards. Each satellite
+   runs its own components as usual, but instead of sending its report
+   to the host it sends what changed to the master, over a UART or
+   I2C. The master merges what it hears from every satellite into its
+   own report, and that's what the host sees.
+
+   Changes travel as frames. The first byte of a frame always has its
+   high bit set and the rest never do, so a receiver that comes in
+   halfway through a frame just waits for the next one:
+
+     10siiiii                  button i+1 is now in state s
+     11000aaa 0xxxxxxx 0xxxxxxx 000000xx
+                               axis a is now x (low bits first)
+     11111111                  nothing; padding
+
+   Satellites pick their own button numbers, so make sure no two
+   boards use the same one. A satellite only sends the axes it drives,
+   and give every axis to one board too: if two drive the same one, a
+   satellite beats the master, and of the satellites, the one added
+   last wins.
+
+   Built with FALCONPANEL_HOST, there are no UARTs or I2C, just the
+   frames, the hub and the Uplink base - enough for
+   host/falconpanel-satellites.cpp to put boards on a pretend bus. */
+
+const byte FrameButton = 0x80;
+const byte FrameAxis = 0xC0;
+const byte FrameIdle = 0xFF;
+
+/* Turns changes in a report into frames. Keeps track of what it has
+   managed to send, so anything that didn't fit in the buffer this
+   time goes out next time. */
+class FrameEncoder {
+ private:
+  byte* _buf;
+  byte _capacity;
+  byte _head;
+  byte _size;
+  unsigned long _sentButtons;
+  unsigned long _staleButtons;
+  int _sentAxes[AxisCount];
+  byte _staleAxes;
+
+  void put(byte b) {
+    _buf[(_head + _size) % _capacity] = b;
+    ++_size;
+  }
+
+ public:
+  FrameEncoder(byte capacity) {
+    _buf = new byte[capacity];
+    _capacity = capacity;
+    _head = 0;
+    _size = 0;
+    _sentButtons = 0;
+    _staleButtons = 0;
+    for (byte i = 0; i < AxisCount; ++i) {
+      _sentAxes[i] = 0;
+    }
+    _staleAxes = 0;
+    refresh();
+  }
+
+  /* Forgets what's been sent, so that everything goes out again. Lets
+     a master that restarted, or missed something, catch up. Axes the
+     report has never set still don't go out: they'd be zeros, and
+     they'd trample whatever the master has on them. */
+  void refresh() {
+    _staleButtons = 0xFFFFFFFFUL;
+    _staleAxes = (1 << AxisCount) - 1;
+  }
+
+  void encode(Report* report) {
+    unsigned long buttons = report->buttons();
+    unsigned long changed = (buttons ^ _sentButtons) | _staleButtons;
+    for (byte i = 0; changed && _size < _capacity; ++i, changed >>= 1) {
+      if (changed & 1) {
+        unsigned long bit = 1UL << i;
+        put(FrameButton | ((buttons & bit) ? 0x20 : 0) | i);
+        _sentButtons = (_sentButtons & ~bit) | (buttons & bit);
+        _staleButtons &= ~bit;
+      }
+    }
+
+    byte used = report->usedAxes();
+    for (byte i = 0; i < AxisCount && _size + 4 <= _capacity; ++i) {
+      if (!bitRead(used, i)) {
+        continue;
+      }
+      unsigned int val = report->axis(i);
+      if (val != (unsigned int)_sentAxes[i] || bitRead(_staleAxes, i)) {
+        put(FrameAxis | i);
+        put(val & 0x7F);
+        put((val >> 7) & 0x7F);
+        put((val >> 14) & 0x03);
+        _sentAxes[i] = val;
+        _staleAxes &= ~(1 << i);
+      }
+    }
+  }
+
+  byte available() {
+    return _size;
+  }
+
+  byte read() {
+    byte b = _buf[_head];
+    _head = (_head + 1) % _capacity;
+    --_size;
+    return b;
+  }
+};
+
+/* Turns frames back into button and axis states, a byte at a time. */
+class FrameDecoder {
+ private:
+  unsigned long _buttons;
+  int _axes[AxisCount];
+  byte _ownedAxes;
+  byte _axis;
+  byte _pending;
+  unsigned int _val;
+  bool _changed;
+
+ public:
+  FrameDecoder() {
+    _buttons = 0;
+    for (byte i = 0; i < AxisCount; ++i) {
+      _axes[i] = 0;
+    }
+    _ownedAxes = 0;
+    _pending = 0;
+    _changed = false;
+  }
+
+  void feed(byte b) {
+    if (b == FrameIdle) {
+      _pending = 0;
+    }
+    else if ((b & 0xC0) == FrameButton) {
+      unsigned long bit = 1UL << (b & 0x1F);
+      unsigned long buttons = (b & 0x20) ? (_buttons | bit) : (_buttons & ~bit);
+      _changed |= buttons != _buttons;
+      _buttons = buttons;
+      _pending = 0;
+    }
+    else if ((b & 0xF8) == FrameAxis) {
+      _axis = b & 0x07;
+      _pending = _axis < AxisCount ? 3 : 0;
+      _val = 0;
+    }
+    else if (!(b & 0x80) && _pending) {
+      _val |= (unsigned int)b << (7 * (3 - _pending));
+      if (--_pending == 0) {
+        // Sixteen bits came over; put the sign back.
+        int value = int16_t(_val);
+        _changed |= value != _axes[_axis] || !bitRead(_ownedAxes, _axis);
+        _axes[_axis] = value;
+        _ownedAxes |= 1 << _axis;
+      }
+    }
+    else {
+      _pending = 0;
+    }
+  }
+
+  /* True if anything changed since the last call. */
+  bool changed() {
+    bool changed = _changed;
+    _changed = false;
+    return changed;
+  }
+
+  void mergeInto(Report* report) {
+    report->setButtons(report->buttons() | _buttons);
+    for (byte i = 0; i < AxisCount; ++i) {
+      if (bitRead(_ownedAxes, i)) {
+        report->setAxis(i, _axes[i]);
+      }
+    }
+  }
+};
+
+/* The master's end of the connection to one satellite. */
+class SatelliteLink : public Stateful {
+ protected:
+  FrameDecoder _decoder;
+
+ public:
+  /* Reads whatever the satellite has sent. */
+  virtual void poll() = 0;
+
+  FrameDecoder* decoder() {
+    return &_decoder;
+  }
+};
+
+#ifndef FALCONPANEL_HOST
+
+/* A satellite on a hardware serial port, like Serial1. One satellite
+   per port. */
+class UartSatelliteLink : public SatelliteLink {
+ private:
+  HardwareSerial* _port;
+  long _baud;
+
+ public:
+  UartSatelliteLink(HardwareSerial* port, long baud = 115200) {
+    _port = port;
+    _baud = baud;
+  }
+
+  virtual void setup() {
+    _port->begin(_baud);
+  }
+
+  virtual void poll() {
+    while (_port->available() > 0) {
+      _decoder.feed(_port->read());
+    }
+  }
+};
+
+/* A satellite on the I2C bus at `address`. The master asks each
+   satellite in turn for `chunk` bytes; a satellite with nothing to
+   say pads its answer with FrameIdle. */
+class I2cSatelliteLink : public SatelliteLink {
+ private:
+  byte _address;
+  byte _chunk;
+
+ public:
+  I2cSatelliteLink(byte address, byte chunk = 16) {
+    _address = address;
+    _chunk = chunk;
+  }
+
+  virtual void setup() {
+    Wire.begin();
+    Wire.setClock(400000);
+  }
+
+  virtual void poll() {
+    Wire.requestFrom(_address, _chunk);
+    while (Wire.available() > 0) {
+      _decoder.feed(Wire.read());
+    }
+  }
+};
+
+#endif
+
+/* All the satellites a master is listening to. Polls one of them
+   every `periodMs`, taking turns, rather than waiting on the master's
+   own scan. An I2C poll waits for the satellite's answer - 16 bytes
+   at 400kHz is about half a millisecond - so doing them all at once
+   would hold the loop up for longer than the period. Taking turns,
+   each satellite is heard from every `periodMs` times however many
+   there are: with two, their changes get to the host within a couple
+   of milliseconds. */
+class SatelliteHub : public Timer {
+ private:
+  SatelliteLink** _links;
+  byte _count;
+  byte _capacity;
+  byte _next;
+  unsigned int _periodMs;
+  bool _changed;
+
+ public:
+  SatelliteHub(byte capacity, unsigned int periodMs = 1) {
+    _links = new SatelliteLink*[capacity];
+    _count = 0;
+    _capacity = capacity;
+    _next = 0;
+    _periodMs = periodMs;
+    _changed = false;
+  }
+
+  void add(SatelliteLink* link) {
+    if (_count < _capacity) {
+      _links[_count++] = link;
+      link->setup();
+      timers.schedule(this, 0);
+    }
+  }
+
+  virtual void expire() {
+    _links[_next]->poll();
+    _changed |= _links[_next]->decoder()->changed();
+    _next = (_next + 1) % _count;
+    timers.schedule(this, _periodMs);
+  }
+
+  /* True if any satellite has had a change since the last call. */
+  bool changed() {
+    bool changed = _changed;
+    _changed = false;
+    return changed;
+  }
+
+  void mergeInto(Report* report) {
+    for (byte i = 0; i < _count; ++i) {
+      _links[i]->decoder()->mergeInto(report);
+    }
+  }
+};
+
+/* A satellite's end of the connection to the master. */
+class Uplink : public Stateful, public Timer {
+ protected:
+  FrameEncoder _encoder;
+
+  /* Hands as much of what's been encoded as will go to the
+     transport. */
+  virtual void flush() = 0;
+
+ public:
+  Uplink() : _encoder(64) {
+  }
+
+  virtual void send(Report* report) {
+    _encoder.encode(report);
+    report->clean();
+    flush();
+  }
+
+  /* Sends everything again now and then, in case the master missed
+     something or started after we did. */
+  virtual void expire() {
+    _encoder.refresh();
+    timers.schedule(this, 1000);
+  }
+};
+
+#ifndef FALCONPANEL_HOST
+
+/* Sends to the master over a hardware serial port. */
+class UartUplink : public Uplink {
+ private:
+  HardwareSerial* _port;
+  long _baud;
+
+ protected:
+  virtual void flush() {
+    int room = _port->availableForWrite();
+    while (room-- > 0 && _encoder.available() > 0) {
+      _port->write(_encoder.read());
+    }
+  }
+
+ public:
+  UartUplink(HardwareSerial* port, long baud = 115200) {
+    _port = port;
+    _baud = baud;
+  }
+
+  virtual void setup() {
+    _port->begin(_baud);
+    timers.schedule(this, 1000);
+  }
+};
+
+/* Sends to the master as an I2C slave at `address`. The master pulls
+   rather than us pushing, so all flush() has to do is wait. The
+   master clocks out exactly `chunk` bytes per request and anything
+   more is lost, so this has to match the chunk size the master's
+   I2cSatelliteLink uses. */
+class I2cUplink : public Uplink {
+ private:
+  byte _address;
+  byte _chunk;
+
+  static I2cUplink* _instance;
+
+  /* Called from the I2C interrupt. */
+  static void onRequest() {
+    I2cUplink* self = _instance;
+    byte sent = 0;
+    while (sent < self->_chunk && self->_encoder.available() > 0) {
+      Wire.write(self->_encoder.read());
+      ++sent;
+    }
+    while (sent < self->_chunk) {
+      Wire.write(FrameIdle);
+      ++sent;
+    }
+  }
+
+ protected:
+  virtual void flush() {
+  }
+
+ public:
+  I2cUplink(byte address, byte chunk = 16) {
+    _address = address;
+    _chunk = chunk;
+  }
+
+  virtual void send(Report* report) {
+    noInterrupts();
+    Uplink::send(report);
+    interrupts();
+  }
+
+  virtual void setup() {
+    _instance = this;
+    Wire.begin(_address);
+    Wire.onRequest(onRequest);
+    timers.schedule(this, 1000);
+  }
+};
+
+I2cUplink* I2cUplink::_instance = 0;
+
+#endif
+
+#endif
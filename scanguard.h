@@ -0,0 +1,80 @@
+#ifndef _SCANGUARD_H
+#define _SCANGUARD_H
+
+/* Keeps the loop honest. The watchdog resets the board if a pass
+   through the loop ever takes longer than `watchdogMs` - a component
+   stuck in a loop, or an I2C bus that's hung - rather than leaving the
+   panel frozen, and the flight recorder shows what it was doing.
+
+   Short of that, every scan has a budget. A scan that goes over it
+   is an overrun, and for the next `shedScans` scans the components
+   that can wait - the ones whose sheddable() says so, which is the
+   pots - are skipped, and so is anything else that checks shedding(),
+   like the diagnostics. Switches and encoders carry on at full rate.
+   Every overrun goes in the flight recorder. */
+class ScanGuard {
+ private:
+  unsigned long _budgetUs;
+  byte _shedScans;
+  unsigned int _watchdogMs;
+  byte _shedding;
+  unsigned long _overruns;
+  unsigned long _shed;
+  unsigned long _worstUs;
+
+ public:
+  ScanGuard(unsigned long budgetUs, byte shedScans = 8, unsigned int watchdogMs = 500) {
+    _budgetUs = budgetUs;
+    _shedScans = shedScans;
+    _watchdogMs = watchdogMs;
+    _shedding = 0;
+    _overruns = 0;
+    _shed = 0;
+    _worstUs = 0;
+  }
+
+  /* Arms the watchdog. From here on, kick() has to be called at least
+     every `watchdogMs`. */
+  void start() {
+    halWatchdogStart(_watchdogMs);
+  }
+
+  void kick() {
+    halWatchdogKick();
+  }
+
+  bool shedding() {
+    return _shedding > 0;
+  }
+
+  /* Something was skipped because we're shedding. */
+  void skipped() {
+    ++_shed;
+  }
+
+  void scanned(unsigned long us) {
+    if (us > _budgetUs) {
+      ++_overruns;
+      _worstUs = max(_worstUs, us);
+      _shedding = _shedScans;
+      recorder.log(RecordOverrun, 0, us);
+    }
+    else if (_shedding > 0) {
+      --_shedding;
+    }
+  }
+
+  void status(Print* out) {
+    out->print(F("budget "));
+    out->print(_budgetUs);
+    out->print(F("us, overruns "));
+    out->print(_overruns);
+    out->print(F(", worst "));
+    out->print(_worstUs);
+    out->print(F("us, shed "));
+    out->print(_shed);
+    out->println(shedding() ? F(", shedding now") : F(""));
+  }
+};
+
+#endif